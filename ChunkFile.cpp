@@ -0,0 +1,120 @@
+#include "ChunkFile.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ChunkFile::ChunkFile(std::string const &filename_) : filename(filename_) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open '" + filename + "'.");
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(file_size.QuadPart);
+	if (size != 0) { //(empty files can't be mapped, but also don't need to be)
+		HANDLE handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (handle == nullptr) {
+			CloseHandle(file);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+		data = reinterpret_cast< char const * >(MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0));
+		if (data == nullptr) {
+			CloseHandle(handle);
+			CloseHandle(file);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+		mapping = handle;
+	}
+	CloseHandle(file); //(the mapping keeps the file open)
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open '" + filename + "'.");
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(st.st_size);
+	if (size != 0) { //(empty files can't be mapped, but also don't need to be)
+		void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+		data = reinterpret_cast< char const * >(ptr);
+	}
+	close(fd); //(the mapping keeps the file open)
+#endif
+}
+
+ChunkFile::~ChunkFile() {
+	if (data == nullptr) return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(reinterpret_cast< HANDLE >(mapping));
+#else
+	munmap(const_cast< char * >(data), size);
+#endif
+}
+
+bool ChunkFile::next_is(std::string const &magic) const {
+	assert(magic.size() == 4);
+	return size - offset >= 8 && std::memcmp(data + offset, magic.data(), 4) == 0;
+}
+
+void const *ChunkFile::read_chunk_data(std::string const &magic, size_t element_size, size_t alignment, size_t *size_) {
+	assert(magic.size() == 4);
+	assert(size_);
+
+	struct ChunkHeader {
+		char magic[4];
+		uint32_t size;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	if (size - offset < sizeof(ChunkHeader)) {
+		throw std::runtime_error("Failed to read chunk header ('" + magic + "' in '" + filename + "').");
+	}
+	ChunkHeader header;
+	std::memcpy(&header, data + offset, sizeof(header));
+	offset += sizeof(header);
+
+	if (std::string(header.magic, 4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk (expected '" + magic + "' in '" + filename + "').");
+	}
+	if (header.size % element_size != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size ('" + magic + "' in '" + filename + "').");
+	}
+	if (size - offset < header.size) {
+		throw std::runtime_error("Failed to read chunk data ('" + magic + "' in '" + filename + "').");
+	}
+
+	char const *chunk = data + offset;
+	offset += header.size;
+	*size_ = header.size;
+
+	//use the mapped data directly if it is suitably aligned; otherwise copy it to aligned storage:
+	if (reinterpret_cast< uintptr_t >(chunk) % alignment != 0) {
+		copies.emplace_back((header.size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+		std::memcpy(copies.back().data(), chunk, header.size);
+		chunk = reinterpret_cast< char const * >(copies.back().data());
+	}
+	return chunk;
+}
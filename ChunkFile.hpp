@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+ * A ChunkFile maps a file made of chunks (in the format written by
+ *  write_chunk -- see read_write_chunk.hpp) into memory, and hands out
+ *  typed, bounds-checked views ("ChunkSpan"s) of each chunk's contents
+ *  without copying them.
+ *
+ * Usage:
+ *   ChunkFile file(filename);
+ *   ChunkSpan< Vertex > vertices = file.read< Vertex >("pnct");
+ *   glBufferData(GL_ARRAY_BUFFER, vertices.bytes(), vertices.data(), GL_STATIC_DRAW);
+ *
+ * Spans stay valid as long as the ChunkFile exists.
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+template< typename T >
+struct ChunkSpan {
+	ChunkSpan() = default;
+	ChunkSpan(T const *data_, size_t size_) : data_(data_), size_(size_) { }
+
+	T const *data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t bytes() const { return size_ * sizeof(T); }
+	bool empty() const { return size_ == 0; }
+
+	T const *begin() const { return data_; }
+	T const *end() const { return data_ + size_; }
+
+	//throws if index is out of range:
+	T const &operator[](size_t i) const {
+		if (i >= size_) throw std::runtime_error("Index " + std::to_string(i) + " is past the end of a chunk of " + std::to_string(size_) + " elements.");
+		return data_[i];
+	}
+
+private:
+	T const *data_ = nullptr;
+	size_t size_ = 0;
+};
+
+struct ChunkFile {
+	//map a file:
+	// note: will throw if file fails to open.
+	ChunkFile(std::string const &filename);
+	~ChunkFile();
+
+	//read the next chunk, which must have magic number 'magic' and contain a whole number of T's:
+	// note: will throw if the chunk is missing, has the wrong magic, or has the wrong size.
+	template< typename T >
+	ChunkSpan< T > read(std::string const &magic) {
+		static_assert(std::is_trivially_copyable< T >::value, "Chunks hold plain old data.");
+		size_t size = 0;
+		void const *data = read_chunk_data(magic, sizeof(T), alignof(T), &size);
+		return ChunkSpan< T >(reinterpret_cast< T const * >(data), size / sizeof(T));
+	}
+
+	//is there no more data after the last chunk read?
+	bool at_end() const { return offset == size; }
+
+	//does the next chunk have magic number 'magic'? (useful for optional chunks)
+	bool next_is(std::string const &magic) const;
+
+	std::string filename;
+
+	//mappings aren't copyable:
+	ChunkFile(ChunkFile const &) = delete;
+	ChunkFile &operator=(ChunkFile const &) = delete;
+
+private:
+	//returns a pointer to the next chunk's data (aligned to 'alignment') and stores its size in *size:
+	void const *read_chunk_data(std::string const &magic, size_t element_size, size_t alignment, size_t *size);
+
+	char const *data = nullptr; //mapped file contents
+	size_t size = 0; //size of mapped file
+	size_t offset = 0; //start of next chunk
+
+	//chunks that aren't suitably aligned in the file are copied here:
+	std::list< std::vector< std::max_align_t > > copies;
+
+	//platform-specific mapping handle:
+	void *mapping = nullptr;
+};
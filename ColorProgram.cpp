@@ -3,7 +3,13 @@
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
-Load< ColorProgram > color_program(LoadTagEarly);
+LazyLoad< ColorProgram > color_program([]() -> ColorProgram * {
+	return new ColorProgram(); //(compiles shaders, so never prefetch()ed)
+}, [](ColorProgram const &) -> size_t {
+	//(a linked program lives in the driver: compiled code for each stage plus reflection data --
+	// for programs this small, saved binaries run to tens of kilobytes)
+	return 32 * 1024;
+});
 
 ColorProgram::ColorProgram() {
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
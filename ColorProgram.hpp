@@ -18,4 +18,5 @@ struct ColorProgram {
 	// none
 };
 
-extern Load< ColorProgram > color_program;
+//(loaded the first time it is used)
+extern LazyLoad< ColorProgram > color_program;
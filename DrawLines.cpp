@@ -1,56 +1,69 @@
 #include "DrawLines.hpp"
 #include "PathFont.hpp"
 #include "ColorProgram.hpp"
+#include "Profiler.hpp"
+#include "FrameStats.hpp"
 
 #include "gl_errors.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-//All DrawLines instances share a vertex array object and vertex buffer, initialized at load time:
-
-//n.b. declared static so they don't conflict with similarly named global variables elsewhere:
-static GLuint vertex_buffer = 0;
-static GLuint vertex_buffer_for_color_program = 0;
+//All DrawLines instances share a vertex array object and vertex buffer, made the first time anything is drawn:
+struct DrawLinesBuffers {
+	~DrawLinesBuffers() {
+		glDeleteVertexArrays(1, &vertex_buffer_for_color_program);
+		glDeleteBuffers(1, &vertex_buffer);
+	}
+	std::shared_ptr< ColorProgram const > program; //(kept loaded along with the buffers)
+	GLuint vertex_buffer = 0;
+	GLuint vertex_buffer_for_color_program = 0;
+};
+
+//n.b. declared static so it doesn't conflict with similarly named global variables elsewhere:
+static LazyLoad< DrawLinesBuffers > buffers([]() -> DrawLinesBuffers * {
+	//(made on the main thread, since this is never prefetch()ed)
+	DrawLinesBuffers *ret = new DrawLinesBuffers;
+	ret->program = color_program.get();
+	ColorProgram const &color_program = *ret->program;
 
-static Load< void > setup_buffers(LoadTagDefault, [](){
 	//you may recognize this init code from DrawSprites.cpp:
 
 	{ //set up vertex buffer:
-		glGenBuffers(1, &vertex_buffer);
+		glGenBuffers(1, &ret->vertex_buffer);
 		//for now, buffer will be un-filled.
 	}
 
 	{ //vertex array mapping buffer for color_program:
 		//ask OpenGL to fill vertex_buffer_for_color_program with the name of an unused vertex array object:
-		glGenVertexArrays(1, &vertex_buffer_for_color_program);
+		glGenVertexArrays(1, &ret->vertex_buffer_for_color_program);
 
 		//set vertex_buffer_for_color_program as the current vertex array object:
-		glBindVertexArray(vertex_buffer_for_color_program);
+		glBindVertexArray(ret->vertex_buffer_for_color_program);
 
 		//set vertex_buffer as the source of glVertexAttribPointer() commands:
-		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, ret->vertex_buffer);
 
 		//set up the vertex array object to describe arrays of PongMode::Vertex:
 		glVertexAttribPointer(
-			color_program->Position_vec4, //attribute
+			color_program.Position_vec4, //attribute
 			3, //size
 			GL_FLOAT, //type
 			GL_FALSE, //normalized
 			sizeof(DrawLines::Vertex), //stride
 			(GLbyte *)0 + offsetof(DrawLines::Vertex, Position) //offset
 		);
-		glEnableVertexAttribArray(color_program->Position_vec4);
+		glEnableVertexAttribArray(color_program.Position_vec4);
 		//[Note that it is okay to bind a vec3 input to a vec4 attribute -- the w component will be filled with 1.0 automatically]
 
 		glVertexAttribPointer(
-			color_program->Color_vec4, //attribute
+			color_program.Color_vec4, //attribute
 			4, //size
 			GL_UNSIGNED_BYTE, //type
 			GL_TRUE, //normalized
 			sizeof(DrawLines::Vertex), //stride
 			(GLbyte *)0 + offsetof(DrawLines::Vertex, Color) //offset
 		);
-		glEnableVertexAttribArray(color_program->Color_vec4);
+		glEnableVertexAttribArray(color_program.Color_vec4);
 
 		//done referring to vertex_buffer, so unbind it:
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -60,6 +73,11 @@ static Load< void > setup_buffers(LoadTagDefault, [](){
 	}
 
 	GL_ERRORS(); //PARANOIA: make sure nothing strange happened during setup
+
+	return ret;
+}, [](DrawLinesBuffers const &) -> size_t {
+	//(the vertex buffer starts empty; drawing updates 'buffers.bytes' as it refills the buffer)
+	return 0;
 });
 
 
@@ -134,25 +152,35 @@ void DrawLines::draw_text(std::string const &text, glm::vec3 const &anchor_in, g
 
 DrawLines::~DrawLines() {
 	if (attribs.empty()) return;
+	PROFILE_ZONE("DrawLines::~DrawLines");
+	FrameStats::GPUTimer gpu_timer(FrameStats::LinesPass);
 
 	//based on DrawSprites.cpp :
 
+	//(loads buffers and program on first use; they stay loaded at least until drawing is done)
+	std::shared_ptr< DrawLinesBuffers const > loaded = buffers.get();
+	GLuint vertex_buffer = loaded->vertex_buffer;
+	GLuint vertex_buffer_for_color_program = loaded->vertex_buffer_for_color_program;
+	ColorProgram const &color_program = *loaded->program;
+
 	//upload vertices to vertex_buffer:
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer); //set vertex_buffer as current
 	glBufferData(GL_ARRAY_BUFFER, attribs.size() * sizeof(attribs[0]), attribs.data(), GL_STREAM_DRAW); //upload attribs array
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	buffers.bytes = attribs.size() * sizeof(attribs[0]); //(the buffer now holds this much; counted against the lazy load budget)
 
 	//set color_program as current program:
-	glUseProgram(color_program->program);
+	glUseProgram(color_program.program);
 
 	//upload OBJECT_TO_CLIP to the proper uniform location:
-	glUniformMatrix4fv(color_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+	glUniformMatrix4fv(color_program.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
 
 	//use the mapping vertex_buffer_for_color_program to fetch vertex data:
 	glBindVertexArray(vertex_buffer_for_color_program);
 
 	//run the OpenGL pipeline:
 	glDrawArrays(GL_LINES, 0, GLsizei(attribs.size()));
+	FrameStats::count_draw(GL_LINES, GLsizei(attribs.size()));
 
 	//reset vertex array to none:
 	glBindVertexArray(0);
@@ -0,0 +1,267 @@
+#include "FrameStats.hpp"
+
+#include "DrawLines.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+bool FrameStats::show_overlay = false;
+
+namespace {
+	using namespace FrameStats;
+
+	//frames kept for computing percentiles:
+	constexpr uint32_t History = 600;
+	//frames shown in the graph:
+	constexpr uint32_t GraphFrames = 120;
+
+	struct Frame {
+		float frame_ms = 0.0f; //begin_frame() to the next begin_frame()
+		float cpu_ms = 0.0f; //begin_frame() to end_frame()
+		float gpu_ms[PassCount] = { };
+		uint32_t pending_queries = 0; //(gpu_ms is final once this is zero)
+		uint32_t draw_calls = 0;
+		uint64_t triangles = 0;
+	};
+
+	//a GL_TIME_ELAPSED query that hasn't been read back yet:
+	struct PendingQuery {
+		GLuint query;
+		uint64_t frame;
+		Pass pass;
+	};
+
+	struct Stats {
+		std::array< Frame, History > frames;
+		uint64_t frame = 0; //current frame, stored in frames[frame % History]
+		std::chrono::steady_clock::time_point frame_begin;
+
+		std::deque< PendingQuery > pending; //(in the order they were issued, which is the order they finish)
+		std::vector< GLuint > free_queries;
+		GLuint timing_query = 0; //query running now, if any
+
+		Frame &current() { return frames[frame % History]; }
+		//is 'f' recent enough to still be stored?
+		bool stored(uint64_t f) const { return f <= frame && frame - f < History; }
+	};
+
+	Stats &get_stats() {
+		static Stats stats;
+		return stats;
+	}
+
+	float ms_since(std::chrono::steady_clock::time_point const &before, std::chrono::steady_clock::time_point const &after) {
+		return std::chrono::duration< float, std::milli >(after - before).count();
+	}
+
+	//the 'p'th percentile of 'values' (which get sorted):
+	float percentile(std::vector< float > &values, float p) {
+		if (values.empty()) return 0.0f;
+		std::sort(values.begin(), values.end());
+		size_t i = size_t(p * float(values.size() - 1) + 0.5f);
+		return values[std::min(i, values.size() - 1)];
+	}
+
+	//read the result of the oldest pending query into its frame:
+	void read_back_query(Stats &stats) {
+		PendingQuery const &pending = stats.pending.front();
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &elapsed);
+		if (stats.stored(pending.frame)) {
+			Frame &frame = stats.frames[pending.frame % History];
+			frame.gpu_ms[pending.pass] += float(double(elapsed) * 1e-6);
+			frame.pending_queries -= 1;
+		}
+		stats.free_queries.emplace_back(pending.query);
+		stats.pending.pop_front();
+	}
+
+	std::string ms(float value) {
+		std::ostringstream str;
+		str << std::fixed << std::setprecision(1) << value;
+		return str.str();
+	}
+}
+
+void FrameStats::begin_frame() {
+	Stats &stats = get_stats();
+	auto now = std::chrono::steady_clock::now();
+	if (stats.frame != 0) {
+		stats.current().frame_ms = ms_since(stats.frame_begin, now);
+	}
+	stats.frame += 1;
+	stats.current() = Frame();
+	stats.frame_begin = now;
+}
+
+void FrameStats::end_frame() {
+	Stats &stats = get_stats();
+	stats.current().cpu_ms = ms_since(stats.frame_begin, std::chrono::steady_clock::now());
+
+	//read back whichever queries have finished (without waiting for the rest):
+	while (!stats.pending.empty()) {
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(stats.pending.front().query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		read_back_query(stats);
+	}
+}
+
+uint64_t FrameStats::current_frame() {
+	return get_stats().frame;
+}
+
+bool FrameStats::get_times(uint64_t f, Times *times) {
+	assert(times);
+	Stats &stats = get_stats();
+	if (f == 0 || !stats.stored(f)) return false;
+	Frame const &frame = stats.frames[f % History];
+	times->frame_ms = frame.frame_ms;
+	times->cpu_ms = frame.cpu_ms;
+	for (uint32_t p = 0; p < PassCount; ++p) {
+		times->gpu_ms[p] = frame.gpu_ms[p];
+	}
+	times->gpu_done = (frame.pending_queries == 0);
+	times->draw_calls = frame.draw_calls;
+	times->triangles = frame.triangles;
+	return true;
+}
+
+void FrameStats::wait_for_gpu() {
+	Stats &stats = get_stats();
+	while (!stats.pending.empty()) {
+		read_back_query(stats); //(waits for the query to finish)
+	}
+}
+
+FrameStats::GPUTimer::GPUTimer(Pass pass) {
+	Stats &stats = get_stats();
+	if (stats.timing_query != 0) return; //(time elapsed queries can't nest)
+
+	if (stats.free_queries.empty()) {
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		stats.free_queries.emplace_back(query);
+	}
+	stats.timing_query = stats.free_queries.back();
+	stats.free_queries.pop_back();
+
+	glBeginQuery(GL_TIME_ELAPSED, stats.timing_query);
+	stats.pending.emplace_back(PendingQuery{stats.timing_query, stats.frame, pass});
+	stats.current().pending_queries += 1;
+	timing = true;
+}
+
+FrameStats::GPUTimer::~GPUTimer() {
+	if (!timing) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	get_stats().timing_query = 0;
+}
+
+void FrameStats::count_draw(GLenum type, GLsizei count, GLsizei instances) {
+	Frame &frame = get_stats().current();
+	frame.draw_calls += 1;
+	uint64_t triangles = 0;
+	if (type == GL_TRIANGLES) triangles = uint64_t(count / 3);
+	else if ((type == GL_TRIANGLE_STRIP || type == GL_TRIANGLE_FAN) && count >= 3) triangles = uint64_t(count - 2);
+	frame.triangles += triangles * uint64_t(instances);
+}
+
+void FrameStats::draw_overlay(glm::uvec2 const &drawable_size) {
+	Stats &stats = get_stats();
+
+	//gather finished frames (i.e., not the current one):
+	std::vector< float > frame_ms, cpu_ms, gpu_ms;
+	std::array< std::vector< float >, PassCount > pass_ms;
+	for (uint64_t f = (stats.frame > History ? stats.frame - History + 1 : 1); f < stats.frame; ++f) {
+		Frame const &frame = stats.frames[f % History];
+		frame_ms.emplace_back(frame.frame_ms);
+		cpu_ms.emplace_back(frame.cpu_ms);
+		if (frame.pending_queries == 0) {
+			float total = 0.0f;
+			for (uint32_t p = 0; p < PassCount; ++p) {
+				pass_ms[p].emplace_back(frame.gpu_ms[p]);
+				total += frame.gpu_ms[p];
+			}
+			gpu_ms.emplace_back(total);
+		}
+	}
+
+	glDisable(GL_DEPTH_TEST);
+
+	//draw in pixel coordinates, with (0,0) at the lower left:
+	DrawLines lines(glm::mat4(
+		2.0f / drawable_size.x, 0.0f, 0.0f, 0.0f,
+		0.0f, 2.0f / drawable_size.y, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		-1.0f, -1.0f, 0.0f, 1.0f
+	));
+
+	glm::u8vec4 const FrameColor(0xaa, 0xaa, 0xaa, 0xff);
+	glm::u8vec4 const CPUColor(0xff, 0xaa, 0x44, 0xff);
+	glm::u8vec4 const GPUColor(0x44, 0xcc, 0xff, 0xff);
+
+	constexpr float Margin = 10.0f;
+	constexpr float BarWidth = 3.0f; //(frame, cpu, and gpu times side-by-side)
+	constexpr float PixelsPerMS = 3.0f;
+	constexpr float GraphMS = 50.0f;
+	float const GraphWidth = GraphFrames * BarWidth;
+	float const GraphHeight = GraphMS * PixelsPerMS;
+
+	{ //graph of recent frames, newest at the right:
+		glm::vec2 origin(Margin, Margin);
+		auto bar = [&](float x, float value, glm::u8vec4 const &color) {
+			float h = std::min(value, GraphMS) * PixelsPerMS;
+			lines.draw(glm::vec3(origin.x + x, origin.y, 0.0f), glm::vec3(origin.x + x, origin.y + h, 0.0f), color);
+		};
+		for (uint32_t i = 0; i < GraphFrames; ++i) {
+			uint64_t f = stats.frame - GraphFrames + i;
+			if (f == 0 || !stats.stored(f) || f == stats.frame) continue;
+			Frame const &frame = stats.frames[f % History];
+			float x = i * BarWidth;
+			bar(x + 0.5f, frame.frame_ms, FrameColor);
+			bar(x + 1.5f, frame.cpu_ms, CPUColor);
+			if (frame.pending_queries == 0) {
+				float total = 0.0f;
+				for (uint32_t p = 0; p < PassCount; ++p) total += frame.gpu_ms[p];
+				bar(x + 2.5f, total, GPUColor);
+			}
+		}
+		//reference lines at 60 and 30 frames per second, and a baseline:
+		for (float line_ms : { 0.0f, 1000.0f / 60.0f, 1000.0f / 30.0f }) {
+			float y = origin.y + line_ms * PixelsPerMS;
+			lines.draw(glm::vec3(origin.x, y, 0.0f), glm::vec3(origin.x + GraphWidth, y, 0.0f), glm::u8vec4(0xff, 0xff, 0xff, 0x66));
+		}
+	}
+
+	{ //numbers, above the graph:
+		constexpr float H = 14.0f; //text height
+		float y = Margin + GraphHeight + 0.5f * H;
+		auto text = [&](std::string const &str, glm::u8vec4 const &color) {
+			//(with a drop shadow, to be readable over anything)
+			lines.draw_text(str, glm::vec3(Margin + 1.0f, y - 1.0f, 0.0f), glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f), glm::u8vec4(0x00, 0x00, 0x00, 0xff));
+			lines.draw_text(str, glm::vec3(Margin, y, 0.0f), glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f), color);
+			y += 1.3f * H;
+		};
+		auto percentiles = [](std::vector< float > &values) {
+			float p50 = percentile(values, 0.50f);
+			float p95 = percentile(values, 0.95f);
+			float p99 = percentile(values, 0.99f);
+			return "p50 " + ms(p50) + "  p95 " + ms(p95) + "  p99 " + ms(p99) + " ms";
+		};
+
+		Frame const &last = (stats.frame > 1 ? stats.frames[(stats.frame - 1) % History] : stats.current());
+		text("draws " + std::to_string(last.draw_calls) + "  triangles " + std::to_string(last.triangles), FrameColor);
+		std::string passes = "  scene " + ms(percentile(pass_ms[ScenePass], 0.50f)) + "  lines " + ms(percentile(pass_ms[LinesPass], 0.50f));
+		text("gpu    " + percentiles(gpu_ms) + passes, GPUColor);
+		text("cpu    " + percentiles(cpu_ms), CPUColor);
+		text("frame  " + percentiles(frame_ms), FrameColor);
+	}
+}
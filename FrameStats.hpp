@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * FrameStats keeps track of recent frames: how long each took on the CPU,
+ *  how long its drawing took on the GPU (measured with timer queries that are
+ *  read back a few frames later, so nothing waits on the GPU), and how many
+ *  draw calls and triangles it sent.
+ *
+ * It can draw these as an overlay -- a graph of recent frame times, along
+ *  with percentiles -- to tell at a glance whether frames are waiting on the
+ *  CPU or the GPU.
+ *
+ * Usage (in the main loop):
+ *   FrameStats::begin_frame();
+ *   Mode::current->update(...);
+ *   Mode::current->draw(...);
+ *   if (FrameStats::show_overlay) FrameStats::draw_overlay(drawable_size);
+ *   FrameStats::end_frame();
+ *   SDL_GL_SwapWindow(window);
+ *
+ * ...and, wherever drawing happens:
+ *   FrameStats::GPUTimer timer(FrameStats::ScenePass); //times GPU work issued until 'timer' is destroyed
+ *   glDrawArrays(type, start, count);
+ *   FrameStats::count_draw(type, count);
+ *
+ */
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace FrameStats {
+	//call at the start of each frame:
+	void begin_frame();
+	//...and after everything has been drawn (but before swapping buffers, which may wait for the display):
+	void end_frame();
+
+	//GPU time is tracked separately for each of these passes:
+	enum Pass : uint32_t {
+		ScenePass, //Scene::submit
+		LinesPass, //DrawLines
+		PassCount
+	};
+
+	//Times the GPU work issued while it exists:
+	// (only one pass may be timed at once; timers started while another is running are ignored)
+	struct GPUTimer {
+		GPUTimer(Pass pass);
+		~GPUTimer();
+		bool timing = false;
+
+		GPUTimer(GPUTimer const &) = delete;
+		GPUTimer &operator=(GPUTimer const &) = delete;
+	};
+
+	//count a draw call of 'count' vertices (drawn 'instances' times):
+	void count_draw(GLenum type, GLsizei count, GLsizei instances = 1);
+
+	//Timings of recent frames, for reporting elsewhere (e.g., by a benchmark):
+	struct Times {
+		float frame_ms = 0.0f; //begin_frame() to the next begin_frame()
+		float cpu_ms = 0.0f; //begin_frame() to end_frame()
+		float gpu_ms[PassCount] = { };
+		bool gpu_done = false; //(have all of the frame's GPU timings been read back?)
+		uint32_t draw_calls = 0;
+		uint64_t triangles = 0;
+	};
+	uint64_t current_frame(); //(frames are numbered from 1 by begin_frame())
+	//returns false if 'frame' is too old to still be stored:
+	bool get_times(uint64_t frame, Times *times);
+	//wait for the GPU to finish and read back every timing:
+	void wait_for_gpu();
+
+	//overlay (toggled by a key in the main loop):
+	extern bool show_overlay;
+	void draw_overlay(glm::uvec2 const &drawable_size);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+ * Names (of meshes, transforms, ...) are often looked up many times;
+ *  a HashedName carries a name along with its hash, so the hash can be
+ *  computed once -- or, for names known ahead of time, by the compiler:
+ *
+ * //hashed at compile time:
+ * static constexpr HashedName CubeName("Cube");
+ * Mesh const &cube = meshes->lookup(CubeName);
+ *
+ * //hashed when called:
+ * Mesh const &mesh = meshes->lookup(mesh_name);
+ *
+ * A FlatNameMap is an open-addressing hash table keyed by such names.
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//64-bit FNV-1a hash:
+constexpr uint64_t hash_name(char const *name, size_t length) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; ++i) {
+		hash = (hash ^ uint64_t(uint8_t(name[i]))) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+struct HashedName {
+	//from a string literal (hashed at compile time when used in a constant expression):
+	template< size_t N >
+	constexpr HashedName(char const (&literal)[N]) : name(literal), length(N - 1), hash(hash_name(literal, N - 1)) { }
+	//from a string (which must outlive the HashedName):
+	HashedName(std::string const &str) : name(str.c_str()), length(str.size()), hash(hash_name(str.c_str(), str.size())) { }
+
+	char const *name;
+	size_t length;
+	uint64_t hash;
+
+	std::string str() const { return std::string(name, length); }
+	bool operator==(std::string const &other) const { return other.size() == length && other.compare(0, length, name, length) == 0; }
+};
+
+template< typename T >
+struct FlatNameMap {
+	//returns nullptr if name is not in the map:
+	T const *find(HashedName const &key) const {
+		if (slots.empty()) return nullptr;
+		size_t mask = slots.size() - 1;
+		for (size_t s = size_t(key.hash) & mask; slots[s] != 0; s = (s + 1) & mask) {
+			Entry const &entry = entries[slots[s] - 1];
+			if (entry.hash == key.hash && key == entry.name) return &entry.value;
+		}
+		return nullptr;
+	}
+
+	//returns false (and leaves the map unchanged) if name is already in the map:
+	bool insert(HashedName const &key, T const &value) {
+		if (find(key)) return false;
+		entries.emplace_back(Entry{key.str(), key.hash, value});
+		//keep the table at most half full:
+		if (entries.size() * 2 > slots.size()) {
+			rehash(slots.empty() ? 16 : slots.size() * 2);
+		} else {
+			place(uint32_t(entries.size() - 1));
+		}
+		return true;
+	}
+
+	size_t size() const { return entries.size(); }
+	bool empty() const { return entries.empty(); }
+	void clear() {
+		entries.clear();
+		slots.clear();
+	}
+
+	//entries, in insertion order:
+	struct Entry {
+		std::string name;
+		uint64_t hash;
+		T value;
+	};
+	std::vector< Entry > entries;
+
+private:
+	void rehash(size_t count) {
+		slots.assign(count, 0);
+		for (uint32_t i = 0; i < uint32_t(entries.size()); ++i) {
+			place(i);
+		}
+	}
+	void place(uint32_t index) {
+		size_t mask = slots.size() - 1;
+		size_t s = size_t(entries[index].hash) & mask;
+		while (slots[s] != 0) s = (s + 1) & mask;
+		slots[s] = index + 1;
+	}
+
+	std::vector< uint32_t > slots; //power-of-two sized; (index into entries) + 1, or 0 for empty
+};
@@ -3,25 +3,23 @@
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
+#include <cassert>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
 
 Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
-	LitColorTextureProgram *ret = new LitColorTextureProgram();
+	LitColorTextureProgram *ret = new LitColorTextureProgram(LitColorTextureProgram::Variant());
 
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	//matrices and light lists come from the per-object uniform block (lights from the per-frame block):
+	lit_color_texture_program_pipeline.uses_object_block = true;
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -43,98 +41,230 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load< LitColorTextureProgram > lit_color_texture_program_instanced(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram::Variant variant;
+	variant.instanced = true;
+	LitColorTextureProgram *ret = new LitColorTextureProgram(variant);
+
+	lit_color_texture_program_pipeline.instanced_program = ret->program;
+
+	return ret;
+});
+
+LitColorTextureProgram const &lit_color_texture_program_variant(LitColorTextureProgram::Variant const &variant) {
+	static std::map< std::tuple< bool, bool, bool, uint32_t >, std::unique_ptr< LitColorTextureProgram > > variants;
+	auto &ret = variants[std::make_tuple(variant.instanced, variant.textured, variant.texture_array, variant.light_types)];
+	if (!ret) ret.reset(new LitColorTextureProgram(variant));
+	return *ret;
+}
+
+//make sure 'program' fits in the vertex attribute locations every driver has:
+// (GL only guarantees 16, so a program needing more might link here but fail on other drivers)
+static void check_attribute_locations(GLuint program) {
+	GLint count = 0;
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+	GLint locations = 0;
+	for (GLint i = 0; i < count; ++i) {
+		char name[128];
+		GLint size = 0;
+		GLenum type = GL_NONE;
+		glGetActiveAttrib(program, GLuint(i), sizeof(name), nullptr, &size, &type, name);
+		//matrices take one location per column:
+		GLint columns = 1;
+		if (type == GL_FLOAT_MAT2 || type == GL_FLOAT_MAT2x3 || type == GL_FLOAT_MAT2x4) columns = 2;
+		if (type == GL_FLOAT_MAT3 || type == GL_FLOAT_MAT3x2 || type == GL_FLOAT_MAT3x4) columns = 3;
+		if (type == GL_FLOAT_MAT4 || type == GL_FLOAT_MAT4x2 || type == GL_FLOAT_MAT4x3) columns = 4;
+		locations += columns * size;
+	}
+	GLint max_attribs = 0;
+	glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+	if (locations > max_attribs) {
+		throw std::runtime_error("LitColorTextureProgram variant uses " + std::to_string(locations) + " vertex attribute locations, but only " + std::to_string(max_attribs) + " are available.");
+	}
+	assert(locations <= 16 && "LitColorTextureProgram variants should fit in the 16 vertex attribute locations GL guarantees");
+}
+
+LitColorTextureProgram::LitColorTextureProgram(Variant const &variant) {
+	//each variant is the shaders below, compiled with a different set of '#define's:
+	std::vector< std::string > defines;
+	if (variant.instanced) defines.emplace_back("INSTANCED");
+	if (variant.textured) defines.emplace_back("TEXTURED");
+	if (variant.textured && variant.texture_array) defines.emplace_back("TEXTURE_ARRAY");
+	if (variant.light_types & PointLights) defines.emplace_back("POINT_LIGHTS");
+	if (variant.light_types & HemisphereLights) defines.emplace_back("HEMISPHERE_LIGHTS");
+	if (variant.light_types & SpotLights) defines.emplace_back("SPOT_LIGHTS");
+	if (variant.light_types & DirectionalLights) defines.emplace_back("DIRECTIONAL_LIGHTS");
+	defines.emplace_back("MAX_FRAME_LIGHTS " + std::to_string(Scene::MaxFrameLights));
+	defines.emplace_back("MAX_OBJECT_LIGHTS " + std::to_string(Scene::MaxObjectLights));
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		//the object-to-* matrices and light list are either per-instance attributes or in the Object uniform block:
+		"#ifdef INSTANCED\n"
+		"in mat4 OBJECT_TO_CLIP;\n"
+		"in mat4x3 OBJECT_TO_LIGHT;\n"
+		"in mat3 NORMAL_TO_LIGHT;\n"
+		//(the light list and texture layer share one attribute, since only 16 attribute locations are guaranteed)
+		"in uvec3 LIGHT_LIST_LAYER;\n"
+		"#define LIGHT_LIST LIGHT_LIST_LAYER.xy\n"
+		"#define TEXTURE_LAYER LIGHT_LIST_LAYER.z\n"
+		"#else\n"
+		"layout(std140) uniform Object {\n" //see Scene::ObjectBlock
+		"	mat4 OBJECT_TO_CLIP;\n"
+		"	mat4x3 OBJECT_TO_LIGHT;\n"
+		"	mat3 NORMAL_TO_LIGHT;\n"
+		"	uvec2 LIGHT_LIST;\n"
+		"	uint TEXTURE_LAYER;\n"
+		"};\n"
+		"#endif\n"
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
-		"in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
+		"#ifdef TEXTURED\n"
+		"in vec2 TexCoord;\n"
 		"out vec2 texCoord;\n"
+		"#endif\n"
+		"#ifdef TEXTURE_ARRAY\n"
+		"flat out uint layer;\n"
+		"#endif\n"
+		"flat out uvec2 lights;\n"
 		"void main() {\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
 		"	normal = NORMAL_TO_LIGHT * Normal;\n"
 		"	color = Color;\n"
+		"#ifdef TEXTURED\n"
 		"	texCoord = TexCoord;\n"
+		"#endif\n"
+		"#ifdef TEXTURE_ARRAY\n"
+		"	layer = TEXTURE_LAYER;\n"
+		"#endif\n"
+		"	lights = LIGHT_LIST;\n"
 		"}\n"
 	,
 		//fragment shader:
 		"#version 330\n"
-		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		"struct Light {\n" //see Scene::FrameBlock::Light
+		"	vec3 LOCATION;\n"
+		"	int TYPE;\n"
+		"	vec3 DIRECTION;\n"
+		"	float CUTOFF;\n"
+		"	vec3 ENERGY;\n"
+		"	float INV_RANGE2;\n"
+		"};\n"
+		"layout(std140) uniform Frame {\n" //see Scene::FrameBlock
+		"	mat4 WORLD_TO_CLIP;\n"
+		"	uvec4 LIGHT_TYPE_END;\n"
+		"	Light LIGHTS[MAX_FRAME_LIGHTS];\n"
+		"};\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
+		"#ifdef TEXTURE_ARRAY\n"
+		"uniform sampler2DArray TEX;\n"
+		"flat in uint layer;\n"
+		"in vec2 texCoord;\n"
+		"#elif defined(TEXTURED)\n"
+		"uniform sampler2D TEX;\n"
 		"in vec2 texCoord;\n"
+		"#endif\n"
+		"flat in uvec2 lights;\n"
 		"out vec4 fragColor;\n"
+		//entry i of this object's light list (four 8-bit light indices per word; unused entries are 0xff, past every LIGHT_TYPE_END):
+		"uint light_index(int i) {\n"
+		"	return (lights[i / 4] >> uint(8 * (i % 4))) & 0xffu;\n"
+		"}\n"
+		//falloff of point and spot lights (and direction to the light):
+		"float falloff(Light light, out vec3 l) {\n"
+		"	l = (light.LOCATION - position);\n"
+		"	float dis2 = dot(l,l);\n"
+		"	l = normalize(l);\n"
+		//(fade out lights with a limited range, so they don't pop when culled)
+		"	float fade = clamp(1.0 - dis2 * light.INV_RANGE2, 0.0, 1.0);\n"
+		"	return fade * fade / max(1.0, dis2);\n"
+		"}\n"
 		"void main() {\n"
 		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"	vec3 e = vec3(0.0);\n"
+		//the light list is sorted by type, so each type gets its own loop;
+		// variants without a type just skip past its lights:
+		"	int i = 0;\n"
+		"	for (; i < MAX_OBJECT_LIGHTS && light_index(i) < LIGHT_TYPE_END[0]; ++i) {\n"
+		"#ifdef POINT_LIGHTS\n"
+		"		Light light = LIGHTS[light_index(i)];\n"
+		"		vec3 l;\n"
+		"		float f = falloff(light, l);\n"
+		"		float nl = max(0.0, dot(n, l)) * f;\n"
+		"		e += nl * light.ENERGY;\n"
+		"#endif\n"
+		"	}\n"
+		"	for (; i < MAX_OBJECT_LIGHTS && light_index(i) < LIGHT_TYPE_END[1]; ++i) {\n"
+		"#ifdef HEMISPHERE_LIGHTS\n"
+		"		Light light = LIGHTS[light_index(i)];\n"
+		"		e += (dot(n,-light.DIRECTION) * 0.5 + 0.5) * light.ENERGY;\n"
+		"#endif\n"
+		"	}\n"
+		"	for (; i < MAX_OBJECT_LIGHTS && light_index(i) < LIGHT_TYPE_END[2]; ++i) {\n"
+		"#ifdef SPOT_LIGHTS\n"
+		"		Light light = LIGHTS[light_index(i)];\n"
+		"		vec3 l;\n"
+		"		float f = falloff(light, l);\n"
+		"		float nl = max(0.0, dot(n, l)) * f;\n"
+		"		float c = dot(l,-light.DIRECTION);\n"
+		"		nl *= smoothstep(light.CUTOFF,mix(light.CUTOFF,1.0,0.1), c);\n"
+		"		e += nl * light.ENERGY;\n"
+		"#endif\n"
 		"	}\n"
+		"	for (; i < MAX_OBJECT_LIGHTS && light_index(i) < LIGHT_TYPE_END[3]; ++i) {\n"
+		"#ifdef DIRECTIONAL_LIGHTS\n"
+		"		Light light = LIGHTS[light_index(i)];\n"
+		"		e += max(0.0, dot(n,-light.DIRECTION)) * light.ENERGY;\n"
+		"#endif\n"
+		"	}\n"
+		"#ifdef TEXTURE_ARRAY\n"
+		"	vec4 albedo = texture(TEX, vec3(texCoord, float(layer))) * color;\n"
+		"#elif defined(TEXTURED)\n"
 		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
+		"#else\n"
+		"	vec4 albedo = color;\n"
+		"#endif\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
 		"}\n"
+	,
+		defines
 	);
 	//As you can see above, adjacent strings in C/C++ are concatenated.
 	// this is very useful for writing long shader programs inline.
 
+	check_attribute_locations(program);
+
 	//look up the locations of vertex attributes:
 	Position_vec4 = glGetAttribLocation(program, "Position");
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
-
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
+	//connect uniform blocks to the buffers Scene::draw fills:
+	gl_bind_uniform_block(program, "Frame", Scene::FrameBinding);
+	gl_bind_uniform_block(program, "Object", Scene::ObjectBinding);
 
+	//look up the locations of uniforms:
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
-	//set TEX to always refer to texture binding zero:
-	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
+	//set TEX (if this variant has it) to always refer to texture binding zero:
+	if (TEX_sampler2D != -1U) {
+		glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
-	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+		glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
 
-	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+		glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+	}
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
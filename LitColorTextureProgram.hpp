@@ -6,7 +6,29 @@
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//Programs are compiled in specialized variants (see gl_compile_program's 'defines'):
+	enum : uint32_t {
+		PointLights = 1,
+		HemisphereLights = 2,
+		SpotLights = 4,
+		DirectionalLights = 8,
+		AllLightTypes = 15
+	};
+	struct Variant {
+		//read OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT, LIGHT_LIST, and TEXTURE_LAYER from per-instance attributes
+		// (see Scene::bind_instance_attributes) instead of the "Object" uniform block:
+		bool instanced = false;
+		//multiply vertex colors by TEXTURE0 (otherwise there is no TexCoord attribute or texture):
+		bool textured = true;
+		//TEXTURE0 is a GL_TEXTURE_2D_ARRAY, sampled at layer TEXTURE_LAYER (see Drawable::Pipeline::texture_layer):
+		// (read from the "Object" block or, in instanced variants, the per-instance LIGHT_LIST_LAYER attribute)
+		bool texture_array = false;
+		//bitmask of the light types to shade with (lights of other types are ignored):
+		uint32_t light_types = AllLightTypes;
+	};
+
+	//lights come from the "Frame" uniform block (see Scene::FrameBlock and Scene::ObjectBlock):
+	LitColorTextureProgram(Variant const &variant);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -17,24 +39,23 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
-	
+	//Uniform blocks:
+	//"Frame" - bound to Scene::FrameBinding
+	//"Object" - bound to Scene::ObjectBinding (not present in instanced variants)
+
 	//Textures:
-	//TEXTURE0 - texture that is accessed by TexCoord
+	//TEXTURE0 - texture that is accessed by TexCoord (not present in untextured variants; an array texture in texture_array variants)
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_program_instanced;
+
+//Other variants are compiled when first asked for:
+// (must be called on the thread with the OpenGL context -- e.g., from a Load<> function)
+LitColorTextureProgram const &lit_color_texture_program_variant(LitColorTextureProgram::Variant const &variant);
 
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+//  (to texture a copy, set textures[0].texture to a TextureStream::get() texture)
+// NOTE: instanced_program is set, but you'll need to supply an instanced_vao to actually use instancing.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
@@ -1,32 +1,348 @@
 #include "Load.hpp"
+#include "Profiler.hpp"
 
-#include <array>
-#include <list>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <thread>
+
+struct LoadJob {
+	LoadTag tag = LoadTagDefault;
+	bool tagged = false; //added with a tag (rather than dependencies)?
+
+	std::vector< LoadBase const * > dependency_loads; //as passed to add_load_function
+	std::vector< LoadJob * > dependencies; //(filled in by begin_load_functions)
+
+	std::function< void() > cpu_fn; //(called on a worker thread)
+	std::function< void() > gl_fn; //(called on the main thread)
+
+	bool background = false; //started by start_background_load (rather than a Load<>)?
+	std::exception_ptr thrown; //(background jobs: exception thrown by cpu_fn, re-thrown by finish_background_load)
+
+	enum State {
+		Waiting, //for dependencies
+		Working, //cpu_fn queued or running
+		Worked, //cpu_fn done (or empty); gl_fn not yet called
+		Done
+	} state = Waiting;
+};
 
 namespace {
-	std::array< std::list< std::function< void() > >, MaxLoadTag > &get_load_lists() {
-		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
-		return load_lists;
+	struct Loader {
+		std::list< LoadJob > jobs; //(list, so pointers stay valid)
+		bool begun = false;
+
+		std::list< LoadJob > background; //jobs from start_background_load (guarded by 'mutex')
+
+		//everything below is guarded by 'mutex':
+		std::mutex mutex;
+		std::condition_variable work_cv; //signalled when cpu_queue gets work (or stopping is set)
+		std::condition_variable worked_cv; //signalled when a job finishes its cpu stage
+		std::deque< LoadJob * > cpu_queue;
+		std::exception_ptr error; //first exception thrown by a cpu_fn
+		uint32_t done = 0; //jobs in the Done state
+		bool stopping = false;
+
+		std::vector< std::thread > workers;
+
+		void work() {
+			profiler_set_thread_name("loader");
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				work_cv.wait(lock, [this](){ return stopping || !cpu_queue.empty(); });
+				if (cpu_queue.empty()) return; //(stopping, and nothing left to do)
+				LoadJob *job = cpu_queue.front();
+				cpu_queue.pop_front();
+
+				lock.unlock();
+				std::exception_ptr thrown;
+				try {
+					PROFILE_ZONE("load (cpu)");
+					job->cpu_fn();
+				} catch (...) {
+					thrown = std::current_exception();
+				}
+				lock.lock();
+
+				if (thrown) {
+					if (job->background) job->thrown = thrown;
+					else if (!error) error = thrown;
+				}
+				job->state = LoadJob::Worked;
+				worked_cv.notify_all();
+			}
+		}
+
+		//stop and join worker threads:
+		// (queued Load<>s are abandoned; queued background jobs still run, since something may be waiting for them)
+		void stop() {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				stopping = true;
+				cpu_queue.erase(std::remove_if(cpu_queue.begin(), cpu_queue.end(), [](LoadJob const *job) {
+					return !job->background;
+				}), cpu_queue.end());
+			}
+			work_cv.notify_all();
+			for (auto &worker : workers) {
+				worker.join();
+			}
+			workers.clear();
+		}
+	};
+
+	Loader &get_loader() {
+		static Loader loader;
+		return loader;
 	}
 }
 
-void add_load_function(LoadTag tag, std::function< void() > const &fn) {
-	auto &load_lists = get_load_lists();
-	assert(tag < load_lists.size());
-	load_lists[tag].emplace_back(fn);
+LoadJob *add_load_function(LoadTag tag, std::function< void() > const &fn) {
+	Loader &loader = get_loader();
+	assert(!loader.begun && "load functions should be added before loading begins");
+	assert(tag < MaxLoadTag);
+	loader.jobs.emplace_back();
+	LoadJob &job = loader.jobs.back();
+	job.tag = tag;
+	job.tagged = true;
+	job.gl_fn = fn;
+	return &job;
+}
+
+LoadJob *add_load_function(std::vector< LoadBase const * > const &dependencies, std::function< void() > const &cpu_fn, std::function< void() > const &gl_fn) {
+	Loader &loader = get_loader();
+	assert(!loader.begun && "load functions should be added before loading begins");
+	loader.jobs.emplace_back();
+	LoadJob &job = loader.jobs.back();
+	job.dependency_loads = dependencies;
+	job.cpu_fn = cpu_fn;
+	job.gl_fn = gl_fn;
+	return &job;
+}
+
+void begin_load_functions() {
+	Loader &loader = get_loader();
+	assert(!loader.begun && "begin_load_functions should only be called *once*");
+	loader.begun = true;
+
+	uint32_t cpu_jobs = 0;
+	for (auto &job : loader.jobs) {
+		//(loads are constructed at global scope, possibly in any order, so dependencies are looked up now)
+		for (LoadBase const *load : job.dependency_loads) {
+			assert(load && load->job && "dependencies should be constructed Load<>s");
+			job.dependencies.emplace_back(load->job);
+		}
+		//tagged functions wait for everything with an earlier tag:
+		if (job.tagged) {
+			for (auto &other : loader.jobs) {
+				if (other.tag < job.tag) job.dependencies.emplace_back(&other);
+			}
+		}
+		if (job.cpu_fn) cpu_jobs += 1;
+	}
+
+	uint32_t threads = std::min(cpu_jobs, std::max(1U, std::thread::hardware_concurrency()));
+	for (uint32_t i = 0; i < threads; ++i) {
+		loader.workers.emplace_back(&Loader::work, &loader);
+	}
+}
+
+bool update_load_functions(float seconds) {
+	Loader &loader = get_loader();
+	assert(loader.begun && "begin_load_functions should be called before update_load_functions");
+
+	PROFILE_ZONE("update_load_functions");
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< float >(seconds));
+
+	std::unique_lock< std::mutex > lock(loader.mutex);
+	while (true) {
+		if (loader.error) {
+			std::exception_ptr error = loader.error;
+			lock.unlock();
+			loader.stop();
+			std::rethrow_exception(error);
+		}
+
+		//start any jobs whose dependencies are done, and pick a job to finish on this thread:
+		LoadJob *finish = nullptr;
+		bool working = false;
+		for (auto &job : loader.jobs) {
+			if (job.state == LoadJob::Waiting) {
+				bool ready = std::all_of(job.dependencies.begin(), job.dependencies.end(), [](LoadJob const *dep) {
+					return dep->state == LoadJob::Done;
+				});
+				if (!ready) continue;
+				if (job.cpu_fn) {
+					job.state = LoadJob::Working;
+					loader.cpu_queue.emplace_back(&job);
+					loader.work_cv.notify_one();
+				} else {
+					job.state = LoadJob::Worked;
+				}
+			}
+			if (job.state == LoadJob::Working) working = true;
+			if (job.state == LoadJob::Worked && !finish) finish = &job;
+		}
+
+		if (finish) {
+			lock.unlock();
+			try {
+				PROFILE_ZONE("load (gl)");
+				if (finish->gl_fn) finish->gl_fn();
+			} catch (...) {
+				loader.stop();
+				throw;
+			}
+			lock.lock();
+			finish->state = LoadJob::Done;
+			loader.done += 1;
+		} else if (loader.done == loader.jobs.size()) {
+			lock.unlock();
+			loader.stop();
+			return true;
+		} else if (!working) {
+			lock.unlock();
+			loader.stop();
+			throw std::runtime_error("Load functions have circular dependencies.");
+		} else {
+			//wait for a worker to finish something:
+			if (loader.worked_cv.wait_until(lock, deadline) == std::cv_status::timeout) return false;
+			continue;
+		}
+
+		if (std::chrono::steady_clock::now() >= deadline) return false;
+	}
 }
 
 void call_load_functions() {
-	static bool has_been_called = false;
-	assert(!has_been_called && "call_load_functions should only be called *once*");
-	has_been_called = true;
+	begin_load_functions();
+	while (!update_load_functions(1.0f)) {
+		//(keep going)
+	}
+}
+
+LoadJob *start_background_load(std::function< void() > const &cpu_fn) {
+	Loader &loader = get_loader();
+	LoadJob *job;
+	{
+		std::unique_lock< std::mutex > lock(loader.mutex);
+		loader.background.emplace_back();
+		job = &loader.background.back();
+		job->background = true;
+		job->cpu_fn = cpu_fn;
+		job->state = LoadJob::Working;
+		loader.cpu_queue.emplace_back(job);
 
-	auto &load_lists = get_load_lists();
-	for (auto &fn_list : load_lists) {
-		while (!fn_list.empty()) {
-			(*fn_list.begin())(); //call first function in the list
-			fn_list.pop_front(); //remove from list
+		//(stop() joins every worker before returning, so if it was called, no workers are left)
+		loader.stopping = false;
+		if (loader.workers.size() < std::max(1U, std::thread::hardware_concurrency())) {
+			loader.workers.emplace_back(&Loader::work, &loader);
 		}
 	}
+	loader.work_cv.notify_one();
+	return job;
+}
+
+bool background_load_done(LoadJob *job) {
+	Loader &loader = get_loader();
+	std::unique_lock< std::mutex > lock(loader.mutex);
+	return job->state == LoadJob::Worked;
+}
+
+void finish_background_load(LoadJob *job) {
+	Loader &loader = get_loader();
+	std::unique_lock< std::mutex > lock(loader.mutex);
+	loader.worked_cv.wait(lock, [job](){ return job->state == LoadJob::Worked; });
+	std::exception_ptr thrown = job->thrown;
+	loader.background.remove_if([job](LoadJob const &other) { return &other == job; });
+	lock.unlock();
+	if (thrown) std::rethrow_exception(thrown);
+}
+
+void finish_load_functions() {
+	get_loader().stop();
+}
+
+float load_progress() {
+	Loader &loader = get_loader();
+	std::unique_lock< std::mutex > lock(loader.mutex);
+	if (loader.jobs.empty()) return 1.0f;
+	return float(loader.done) / float(loader.jobs.size());
+}
+
+
+namespace {
+	struct LazyLoads {
+		std::vector< LazyLoadBase * > loads;
+		size_t budget = size_t(-1);
+		uint64_t clock = 0;
+	};
+
+	LazyLoads &get_lazy_loads() {
+		static LazyLoads lazy_loads;
+		return lazy_loads;
+	}
+}
+
+LazyLoadBase::LazyLoadBase() {
+	get_lazy_loads().loads.emplace_back(this);
+}
+
+LazyLoadBase::~LazyLoadBase() {
+	auto &loads = get_lazy_loads().loads;
+	loads.erase(std::remove(loads.begin(), loads.end(), this), loads.end());
+}
+
+void LazyLoadBase::mark_used() {
+	LazyLoads &lazy_loads = get_lazy_loads();
+	lazy_loads.clock += 1;
+	last_used = lazy_loads.clock;
+}
+
+void LazyLoadBase::touch() {
+	mark_used();
+	evict_lazy_loads();
+}
+
+void set_lazy_load_budget(size_t bytes) {
+	get_lazy_loads().budget = bytes;
+}
+
+size_t lazy_load_bytes() {
+	size_t total = 0;
+	for (LazyLoadBase const *load : get_lazy_loads().loads) {
+		if (load->loaded()) total += load->bytes;
+	}
+	return total;
+}
+
+void evict_lazy_loads() {
+	LazyLoads &lazy_loads = get_lazy_loads();
+
+	//finish loading anything prefetched, so it counts against the budget:
+	for (LazyLoadBase *load : lazy_loads.loads) {
+		load->finish_prefetch();
+	}
+
+	size_t total = lazy_load_bytes();
+	if (total <= lazy_loads.budget) return;
+
+	std::vector< LazyLoadBase * > unused;
+	for (LazyLoadBase *load : lazy_loads.loads) {
+		if (load->loaded() && !load->in_use()) unused.emplace_back(load);
+	}
+	std::sort(unused.begin(), unused.end(), [](LazyLoadBase const *a, LazyLoadBase const *b) {
+		return a->last_used < b->last_used;
+	});
+	for (LazyLoadBase *load : unused) {
+		if (total <= lazy_loads.budget) break;
+		total -= load->bytes;
+		load->unload();
+	}
 }
@@ -20,10 +20,38 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. Meshes] before looking up individual elements within them.)
  *
+ * Loads may instead list the other loads they depend on, and be split into two stages:
+ *
+ * Load< Level > level({ &tiles }, []() -> Level * {
+ *     return new Level(data_path("level.dat")); //runs on a worker thread (no OpenGL!) after 'tiles' has loaded
+ * }, [](Level *level) {
+ *     level->upload(); //runs on the main thread
+ * });
+ *
+ * Loads with dependencies run as soon as those dependencies are done, so independent loads run at the same time.
+ *
+ * A LazyLoad< T > is instead loaded the first time it is used (or when prefetch()ed), and may be unloaded
+ *  again when nothing is using it and loaded resources are over budget (see set_lazy_load_budget):
+ *
+ * LazyLoad< Level > bonus_level([]() -> Level * {
+ *     return new Level(data_path("bonus.dat"));
+ * }, [](Level const &level) -> size_t {
+ *     return level.tiles.size() * sizeof(Tile); //(memory -- including GPU memory -- the loaded value holds on to)
+ * }, [](Level *level) {
+ *     level->upload();
+ * });
+ *
+ * //later:
+ * std::shared_ptr< Level const > level = bonus_level.get(); //(loads, if needed; stays loaded while 'level' exists)
+ *
  */
 
+#include <cassert>
+#include <cstddef>
 #include <functional>
+#include <memory>
 #include <stdexcept>
+#include <vector>
 
 enum LoadTag : uint32_t {
 	LoadTagEarly,
@@ -32,25 +60,65 @@ enum LoadTag : uint32_t {
 	MaxLoadTag //<-- just used to track # of load tags
 };
 
+struct LoadJob; //(internal bookkeeping for one load; see Load.cpp)
+
+//Every Load< T > is a LoadBase, so loads can name each other as dependencies:
+struct LoadBase {
+	LoadJob *job = nullptr;
+};
+
 //Add a function to an internal list of loading functions:
-// (only call *before* "call_load_functions()")
-void add_load_function(LoadTag tag, std::function< void() > const &fn);
+// (only call *before* "begin_load_functions()")
+// (the function is called on the main thread after every load with an earlier tag -- including loads with dependencies, which count as LoadTagDefault)
+LoadJob *add_load_function(LoadTag tag, std::function< void() > const &fn);
+
+//Add a two-stage loading function:
+// (only call *before* "begin_load_functions()")
+// cpu_fn is called on a worker thread (so must not use OpenGL) after every load in 'dependencies' is done;
+// gl_fn is then called on the main thread.
+// (either function may be empty)
+LoadJob *add_load_function(std::vector< LoadBase const * > const &dependencies, std::function< void() > const &cpu_fn, std::function< void() > const &gl_fn);
 
 //Call all loading functions:
 // (loading functions may throw exceptions if they fail.)
 // (only call *once*)
+// (this is just begin_load_functions() followed by update_load_functions() until everything is loaded)
 void call_load_functions();
 
+//...or call them a bit at a time (e.g., to draw a loading screen):
+// begin_load_functions() starts worker threads on the loads that are ready to run; (only call *once*)
+// update_load_functions() does main-thread loading work for up to about 'seconds', and returns true once everything is loaded;
+// (exceptions thrown by loading functions -- on any thread -- are re-thrown from update_load_functions())
+void begin_load_functions();
+bool update_load_functions(float seconds);
+
+//fraction of loads (of any kind) that are done:
+float load_progress();
+
+//Run 'cpu_fn' on the loading worker threads (used by LazyLoad::prefetch):
+// (workers are started as needed, at most one per core, and shared with the loads above)
+// (only call on the main thread; returns a job to pass to the functions below)
+LoadJob *start_background_load(std::function< void() > const &cpu_fn);
+//has the job's cpu_fn finished?
+bool background_load_done(LoadJob *job);
+//wait for the job's cpu_fn to finish, then forget the job:
+// (re-throws anything cpu_fn threw)
+void finish_background_load(LoadJob *job);
+
+//Stop the loading worker threads, after waiting for any background loads:
+// (call before exit, if anything may have been prefetch()ed)
+void finish_load_functions();
+
 
 //work-around for MSVC not accepting this as a lambda:
 template< typename T >
 T const *new_T() { return new T; }
 
 template< typename T >
-struct Load {
+struct Load : LoadBase {
 	//Constructing a Load< T > adds the passed function to the list of functions to call:
 	Load(LoadTag tag, const std::function< T const *() > &load_fn = new_T< T >) : value(nullptr) {
-		add_load_function(tag, [this,load_fn](){
+		job = add_load_function(tag, [this,load_fn](){
 			this->value = load_fn();
 			if (!(this->value)) {
 				throw std::runtime_error("Loading failed.");
@@ -58,6 +126,21 @@ struct Load {
 		});
 	}
 
+	//...or adds a two-stage load (see add_load_function, above):
+	// (cpu_fn makes the T; gl_fn, if given, gets to finish it)
+	Load(std::vector< LoadBase const * > const &dependencies, const std::function< T *() > &cpu_fn, const std::function< void(T *) > &gl_fn = nullptr) : value(nullptr) {
+		job = add_load_function(dependencies, [this,cpu_fn](){
+			this->loading = cpu_fn();
+			if (!(this->loading)) {
+				throw std::runtime_error("Loading failed.");
+			}
+		}, [this,gl_fn](){
+			if (gl_fn) gl_fn(this->loading);
+			this->value = this->loading;
+			this->loading = nullptr;
+		});
+	}
+
 	//Make a "Load< T >" behave like a "T const *":
 	explicit operator bool() { return value != nullptr; }
 	operator T const *() { return value; }
@@ -65,17 +148,133 @@ struct Load {
 	T const *operator->() { return value; }
 
 	T const *value;
+
+	T *loading = nullptr; //(between the stages of a two-stage load)
 };
 
 
 //Specialization:
 //Load< void > just calls a function:
 template< >
-struct Load< void > {
+struct Load< void > : LoadBase {
 	//Constructing a Load< T > adds the passed function to the list of functions to call:
 	Load( LoadTag tag, const std::function< void() > &load_fn) {
-		add_load_function(tag, load_fn);
+		job = add_load_function(tag, load_fn);
+	}
+
+	//...or adds a two-stage load (see add_load_function, above):
+	Load(std::vector< LoadBase const * > const &dependencies, const std::function< void() > &cpu_fn, const std::function< void() > &gl_fn = nullptr) {
+		job = add_load_function(dependencies, cpu_fn, gl_fn);
 	}
 };
 
 
+//Every LazyLoad< T > is a LazyLoadBase, so that loaded resources can be tracked and evicted:
+struct LazyLoadBase {
+	LazyLoadBase();
+	virtual ~LazyLoadBase();
+
+	virtual bool loaded() const = 0;
+	virtual bool in_use() const = 0; //are there references to the value besides the LazyLoad's own?
+	virtual void unload() = 0;
+	virtual void finish_prefetch() = 0; //if a prefetch has finished, finish loading its value (main thread only)
+
+	size_t bytes = 0; //(approximate) memory used while loaded (owners of values that grow may update this)
+	uint64_t last_used = 0; //for least-recently-used eviction
+
+protected:
+	//mark as just used:
+	void mark_used();
+	//...then evict other unused loads if over budget:
+	void touch();
+};
+
+//Lazy loads that aren't in use are unloaded (least-recently-used first) when loaded bytes exceed the budget:
+// (the default budget is unlimited -- i.e., nothing is unloaded)
+void set_lazy_load_budget(size_t bytes);
+size_t lazy_load_bytes(); //bytes used by currently-loaded lazy loads
+
+//Unload unused lazy loads until under budget:
+// (this happens automatically whenever a lazy load is loaded; call this to also free memory after references are dropped)
+// (also finishes loading values whose prefetch is done, so they count against the budget)
+// (only call on the main thread)
+void evict_lazy_loads();
+
+template< typename T >
+struct LazyLoad : LazyLoadBase {
+	//load_fn makes the T (on a loading worker thread, if prefetch()ed -- so then it must not use OpenGL);
+	//size_fn estimates the memory it uses once loaded, including GPU memory (this is what the budget counts, so sizeof(T) is rarely right);
+	//gl_fn, if given, finishes it on the main thread.
+	LazyLoad(std::function< T *() > const &load_fn_, std::function< size_t(T const &) > const &size_fn_, std::function< void(T *) > const &gl_fn_ = nullptr)
+		: load_fn(load_fn_), size_fn(size_fn_), gl_fn(gl_fn_) {
+		assert(size_fn && "lazy loads need a size estimate");
+	}
+	//(like Load<>s, values still loaded at exit are not freed -- their OpenGL context may already be gone)
+	// (call finish_load_functions() before exit, so no prefetch is still running)
+	virtual ~LazyLoad() {
+		if (value) new std::shared_ptr< T const >(std::move(value));
+	}
+
+	//Load, if needed, and return a counted reference; the value won't be unloaded while references exist:
+	// (only call on the main thread; may throw if loading fails)
+	std::shared_ptr< T const > get() {
+		if (!value) {
+			if (prefetching) {
+				LoadJob *job = prefetching;
+				prefetching = nullptr;
+				finish_background_load(job); //(waits for load_fn, if it is still running)
+				finish(std::move(prefetched));
+			} else {
+				finish(std::unique_ptr< T >(load_fn()));
+			}
+		}
+		std::shared_ptr< T const > ret = value;
+		touch();
+		return ret;
+	}
+
+	//Hint that the value will be wanted soon, so load_fn can start on a loading worker thread:
+	// (the value is finished -- and counted against the budget -- by the next get() or evict_lazy_loads())
+	void prefetch() {
+		if (!value && !prefetching) {
+			prefetching = start_background_load([this]() {
+				prefetched.reset(load_fn());
+			});
+		}
+	}
+
+	//Make a "LazyLoad< T >" behave (briefly) like a "T const *":
+	// (the value stays loaded until the end of the full expression)
+	std::shared_ptr< T const > operator->() { return get(); }
+
+	virtual bool loaded() const override { return value != nullptr; }
+	virtual bool in_use() const override { return value.use_count() > 1; }
+	virtual void unload() override { value.reset(); }
+	virtual void finish_prefetch() override {
+		if (!prefetching || !background_load_done(prefetching)) return;
+		if (!prefetched) return; //(load_fn failed; leave the error for get() to report)
+		LoadJob *job = prefetching;
+		prefetching = nullptr;
+		finish_background_load(job);
+		finish(std::move(prefetched));
+		mark_used(); //(so it isn't the first thing evicted)
+	}
+
+	//run gl_fn on a newly-made value, and keep it:
+	void finish(std::unique_ptr< T > &&made) {
+		if (!made) {
+			throw std::runtime_error("Loading failed.");
+		}
+		if (gl_fn) gl_fn(made.get());
+		bytes = size_fn(*made);
+		value.reset(made.release());
+	}
+
+	std::function< T *() > load_fn;
+	std::function< size_t(T const &) > size_fn;
+	std::function< void(T *) > gl_fn;
+
+	std::shared_ptr< T const > value; //(null when not loaded)
+	LoadJob *prefetching = nullptr; //(set while a prefetch is pending)
+	std::unique_ptr< T > prefetched; //(written by the prefetch job)
+};
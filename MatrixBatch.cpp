@@ -0,0 +1,293 @@
+#include "MatrixBatch.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//Four-wide float vectors, using whatever SIMD instructions the target has:
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+namespace {
+	struct F4 { __m128 v; };
+	inline F4 load(float const *p) { return F4{_mm_loadu_ps(p)}; }
+	inline void store(float *p, F4 a) { _mm_storeu_ps(p, a.v); }
+	inline F4 splat(float f) { return F4{_mm_set1_ps(f)}; }
+	inline F4 operator+(F4 a, F4 b) { return F4{_mm_add_ps(a.v, b.v)}; }
+	inline F4 operator-(F4 a, F4 b) { return F4{_mm_sub_ps(a.v, b.v)}; }
+	inline F4 operator*(F4 a, F4 b) { return F4{_mm_mul_ps(a.v, b.v)}; }
+	inline F4 operator/(F4 a, F4 b) { return F4{_mm_div_ps(a.v, b.v)}; }
+	inline F4 abs(F4 a) { return F4{_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+	//is a <= b in every lane?
+	inline bool all_le(F4 a, F4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)) == 0xf; }
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+namespace {
+	struct F4 { float32x4_t v; };
+	inline F4 load(float const *p) { return F4{vld1q_f32(p)}; }
+	inline void store(float *p, F4 a) { vst1q_f32(p, a.v); }
+	inline F4 splat(float f) { return F4{vdupq_n_f32(f)}; }
+	inline F4 operator+(F4 a, F4 b) { return F4{vaddq_f32(a.v, b.v)}; }
+	inline F4 operator-(F4 a, F4 b) { return F4{vsubq_f32(a.v, b.v)}; }
+	inline F4 operator*(F4 a, F4 b) { return F4{vmulq_f32(a.v, b.v)}; }
+	inline F4 operator/(F4 a, F4 b) { return F4{vdivq_f32(a.v, b.v)}; }
+	inline F4 abs(F4 a) { return F4{vabsq_f32(a.v)}; }
+	inline bool all_le(F4 a, F4 b) { return vminvq_u32(vcleq_f32(a.v, b.v)) != 0; }
+}
+#else
+#include <cmath>
+namespace {
+	//(no SIMD instructions available; plain loops, which the compiler may still vectorize)
+	struct F4 { float v[4]; };
+	inline F4 load(float const *p) { return F4{{p[0], p[1], p[2], p[3]}}; }
+	inline void store(float *p, F4 a) { for (uint32_t l = 0; l < 4; ++l) p[l] = a.v[l]; }
+	inline F4 splat(float f) { return F4{{f, f, f, f}}; }
+	inline F4 operator+(F4 a, F4 b) { for (uint32_t l = 0; l < 4; ++l) a.v[l] += b.v[l]; return a; }
+	inline F4 operator-(F4 a, F4 b) { for (uint32_t l = 0; l < 4; ++l) a.v[l] -= b.v[l]; return a; }
+	inline F4 operator*(F4 a, F4 b) { for (uint32_t l = 0; l < 4; ++l) a.v[l] *= b.v[l]; return a; }
+	inline F4 operator/(F4 a, F4 b) { for (uint32_t l = 0; l < 4; ++l) a.v[l] /= b.v[l]; return a; }
+	inline F4 abs(F4 a) { for (uint32_t l = 0; l < 4; ++l) a.v[l] = std::abs(a.v[l]); return a; }
+	inline bool all_le(F4 a, F4 b) { for (uint32_t l = 0; l < 4; ++l) if (!(a.v[l] <= b.v[l])) return false; return true; }
+}
+#endif
+
+void MatrixBatch::reset(uint32_t count_) {
+	count = count_;
+	stride = (count + 3) / 4 * 4;
+	planes.resize(size_t(PlaneCount) * stride);
+	//padding lanes get a harmless matrix so compute() never sees garbage:
+	for (uint32_t i = count; i < stride; ++i) {
+		set(i, glm::mat4x3(1.0f));
+	}
+}
+
+void MatrixBatch::set(uint32_t i, glm::mat4x3 const &object_to_world) {
+	assert(i < stride);
+	for (uint32_t c = 0; c < 4; ++c) {
+		for (uint32_t r = 0; r < 3; ++r) {
+			plane(ObjectToWorld + c * 3 + r)[i] = object_to_world[c][r];
+		}
+	}
+}
+
+namespace {
+	//Helper threads for large batches, started once and kept around
+	// (starting threads every frame costs about as much as the work they would split):
+	struct Helpers {
+		struct Task {
+			std::function< void() > fn;
+			uint32_t *remaining; //decremented (and done_cv signalled) once fn has run
+		};
+
+		//everything below is guarded by 'mutex':
+		std::mutex mutex;
+		std::condition_variable work_cv; //signalled when 'tasks' gets work (or stopping is set)
+		std::condition_variable done_cv; //signalled when a task finishes
+		std::deque< Task > tasks;
+		bool stopping = false;
+
+		std::vector< std::thread > threads; //(started by the first large batch)
+
+		//run one task, with 'lock' held before and after:
+		void run(std::unique_lock< std::mutex > &lock) {
+			Task task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			task.fn();
+			lock.lock();
+			*task.remaining -= 1;
+			done_cv.notify_all();
+		}
+
+		void help() {
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				work_cv.wait(lock, [this](){ return stopping || !tasks.empty(); });
+				if (stopping) return;
+				run(lock);
+			}
+		}
+
+		~Helpers() {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				stopping = true;
+			}
+			work_cv.notify_all();
+			for (auto &thread : threads) {
+				thread.join();
+			}
+		}
+	};
+
+	Helpers &get_helpers() {
+		static Helpers helpers;
+		return helpers;
+	}
+}
+
+void MatrixBatch::compute(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) {
+	uint32_t groups = stride / 4;
+
+	uint32_t threads = 1;
+	if (count >= ParallelThreshold) {
+		threads = std::max(1U, std::min(std::thread::hardware_concurrency(), 8U));
+	}
+
+	if (threads == 1) {
+		compute_groups(0, groups, world_to_clip, world_to_light);
+		return;
+	}
+
+	//split groups evenly over 'threads' threads (this one and the helpers):
+	Helpers &helpers = get_helpers();
+	uint32_t per_thread = (groups + threads - 1) / threads;
+	uint32_t remaining = 0; //(guarded by helpers.mutex)
+	{
+		std::unique_lock< std::mutex > lock(helpers.mutex);
+		while (helpers.threads.size() + 1 < threads) {
+			helpers.threads.emplace_back(&Helpers::help, &helpers);
+		}
+		for (uint32_t begin = per_thread; begin < groups; begin += per_thread) {
+			uint32_t end = std::min(groups, begin + per_thread);
+			helpers.tasks.emplace_back(Helpers::Task{ [this, begin, end, &world_to_clip, &world_to_light]() {
+				compute_groups(begin, end, world_to_clip, world_to_light);
+			}, &remaining });
+			remaining += 1;
+		}
+	}
+	helpers.work_cv.notify_all();
+
+	compute_groups(0, std::min(groups, per_thread), world_to_clip, world_to_light);
+
+	//wait for the other pieces, running any that no helper has started yet:
+	// (batches computed on several threads at once share the helpers, so this may run another batch's piece)
+	std::unique_lock< std::mutex > lock(helpers.mutex);
+	while (remaining > 0) {
+		if (!helpers.tasks.empty()) {
+			helpers.run(lock);
+		} else {
+			helpers.done_cv.wait(lock);
+		}
+	}
+}
+
+void MatrixBatch::compute_groups(uint32_t begin, uint32_t end, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) {
+	//relative tolerance for treating a matrix as rotation + uniform scale:
+	F4 const tolerance = splat(1e-4f);
+
+	for (uint32_t g = begin; g < end; ++g) {
+		uint32_t base = g * 4;
+
+		//object_to_world, as m[column][row]:
+		F4 m[4][3];
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				m[c][r] = load(plane(ObjectToWorld + c * 3 + r) + base);
+			}
+		}
+
+		//object_to_clip = world_to_clip * mat4(object_to_world):
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 4; ++r) {
+				F4 v = m[c][0] * splat(world_to_clip[0][r])
+				     + m[c][1] * splat(world_to_clip[1][r])
+				     + m[c][2] * splat(world_to_clip[2][r]);
+				if (c == 3) v = v + splat(world_to_clip[3][r]); //(translation column has w = 1)
+				store(plane(ObjectToClip + c * 4 + r) + base, v);
+			}
+		}
+
+		//object_to_light = world_to_light * mat4(object_to_world):
+		F4 l[4][3];
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				F4 v = m[c][0] * splat(world_to_light[0][r])
+				     + m[c][1] * splat(world_to_light[1][r])
+				     + m[c][2] * splat(world_to_light[2][r]);
+				if (c == 3) v = v + splat(world_to_light[3][r]);
+				l[c][r] = v;
+				store(plane(ObjectToLight + c * 3 + r) + base, v);
+			}
+		}
+
+		//normal_to_light = inverse(transpose(mat3(object_to_light))):
+		auto dot = [&l](uint32_t a, uint32_t b) {
+			return l[a][0] * l[b][0] + l[a][1] * l[b][1] + l[a][2] * l[b][2];
+		};
+		F4 len2_0 = dot(0,0);
+		F4 limit = len2_0 * tolerance;
+		F4 n[3][3];
+		if (all_le(abs(dot(1,1) - len2_0), limit)
+		 && all_le(abs(dot(2,2) - len2_0), limit)
+		 && all_le(abs(dot(0,1)), limit)
+		 && all_le(abs(dot(0,2)), limit)
+		 && all_le(abs(dot(1,2)), limit)) {
+			//fast path: for s * R (R a rotation), inverse(transpose(s * R)) == (s * R) / s^2:
+			F4 inv_len2 = splat(1.0f) / len2_0;
+			for (uint32_t c = 0; c < 3; ++c) {
+				for (uint32_t r = 0; r < 3; ++r) {
+					n[c][r] = l[c][r] * inv_len2;
+				}
+			}
+		} else {
+			//general case: columns of inverse(transpose(M)) are cross products of M's columns over det(M):
+			auto cross = [&l](uint32_t a, uint32_t b, F4 *out) {
+				out[0] = l[a][1] * l[b][2] - l[a][2] * l[b][1];
+				out[1] = l[a][2] * l[b][0] - l[a][0] * l[b][2];
+				out[2] = l[a][0] * l[b][1] - l[a][1] * l[b][0];
+			};
+			cross(1, 2, n[0]);
+			cross(2, 0, n[1]);
+			cross(0, 1, n[2]);
+			F4 inv_det = splat(1.0f) / (l[0][0] * n[0][0] + l[0][1] * n[0][1] + l[0][2] * n[0][2]);
+			for (uint32_t c = 0; c < 3; ++c) {
+				for (uint32_t r = 0; r < 3; ++r) {
+					n[c][r] = n[c][r] * inv_det;
+				}
+			}
+		}
+		for (uint32_t c = 0; c < 3; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				store(plane(NormalToLight + c * 3 + r) + base, n[c][r]);
+			}
+		}
+	}
+}
+
+glm::mat4 MatrixBatch::object_to_clip(uint32_t i) const {
+	assert(i < count);
+	glm::mat4 ret;
+	for (uint32_t c = 0; c < 4; ++c) {
+		for (uint32_t r = 0; r < 4; ++r) {
+			ret[c][r] = plane(ObjectToClip + c * 4 + r)[i];
+		}
+	}
+	return ret;
+}
+
+glm::mat4x3 MatrixBatch::object_to_light(uint32_t i) const {
+	assert(i < count);
+	glm::mat4x3 ret;
+	for (uint32_t c = 0; c < 4; ++c) {
+		for (uint32_t r = 0; r < 3; ++r) {
+			ret[c][r] = plane(ObjectToLight + c * 3 + r)[i];
+		}
+	}
+	return ret;
+}
+
+glm::mat3 MatrixBatch::normal_to_light(uint32_t i) const {
+	assert(i < count);
+	glm::mat3 ret;
+	for (uint32_t c = 0; c < 3; ++c) {
+		for (uint32_t r = 0; r < 3; ++r) {
+			ret[c][r] = plane(NormalToLight + c * 3 + r)[i];
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * A MatrixBatch computes the per-object matrices used when drawing
+ *  (object-to-clip, object-to-light, and normal-to-light) for many
+ *  objects at once.
+ *
+ * Matrices are stored as structure-of-arrays (one array per matrix
+ *  component), so that compute() can work on four objects per SIMD
+ *  instruction. Large batches are split across several (persistent) threads.
+ *
+ * Usage:
+ *   batch.reset(count);
+ *   for (uint32_t i = 0; i < count; ++i) batch.set(i, object_to_world[i]);
+ *   batch.compute(world_to_clip, world_to_light);
+ *   glm::mat4 object_to_clip = batch.object_to_clip(i);
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct MatrixBatch {
+	//prepare to hold 'count' objects (previous contents are discarded):
+	void reset(uint32_t count);
+	//set the object-to-world matrix for object 'i':
+	void set(uint32_t i, glm::mat4x3 const &object_to_world);
+
+	//compute all output matrices:
+	// (normal-to-light is inverse(transpose(mat3(object-to-light))), except that groups of objects
+	//  whose object-to-light is a rotation and uniform scale skip the inverse)
+	void compute(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light);
+
+	//read results of compute():
+	glm::mat4 object_to_clip(uint32_t i) const;
+	glm::mat4x3 object_to_light(uint32_t i) const;
+	glm::mat3 normal_to_light(uint32_t i) const;
+
+	uint32_t size() const { return count; }
+
+	//batches at least this large are computed on several threads:
+	// (measured: about 60ns per object on one thread, versus a few microseconds to hand a piece
+	//  to a waiting helper thread -- so 1024 objects is ~60us of work, and the hand-off stays under ~5%)
+	static constexpr uint32_t ParallelThreshold = 1024;
+
+	//component arrays ("planes") in storage:
+	enum : uint32_t {
+		ObjectToWorld = 0, //12 planes, column-major
+		ObjectToClip = ObjectToWorld + 12, //16 planes
+		ObjectToLight = ObjectToClip + 16, //12 planes
+		NormalToLight = ObjectToLight + 12, //9 planes
+		PlaneCount = NormalToLight + 9
+	};
+
+private:
+	void compute_groups(uint32_t begin, uint32_t end, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light);
+	float *plane(uint32_t p) { return planes.data() + size_t(p) * stride; }
+	float const *plane(uint32_t p) const { return planes.data() + size_t(p) * stride; }
+
+	uint32_t count = 0; //objects in batch
+	uint32_t stride = 0; //count, rounded up to a multiple of four
+	std::vector< float > planes; //PlaneCount * stride floats
+};
@@ -1,20 +1,21 @@
 #include "Mesh.hpp"
-#include "read_write_chunk.hpp"
+#include "ChunkFile.hpp"
+#include "Profiler.hpp"
 
 #include <glm/glm.hpp>
 
 #include <stdexcept>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <set>
 #include <cstddef>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
-
-	std::ifstream file(filename, std::ios::binary);
+MeshBuffer::MeshBuffer(std::string const &filename, Upload when) {
+	PROFILE_ZONE("MeshBuffer::MeshBuffer");
+	//(vertex data is uploaded directly from the mapped file)
+	pending_file.reset(new ChunkFile(filename));
+	ChunkFile &file = *pending_file;
 
 	GLuint total = 0;
 
@@ -25,16 +26,15 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glm::vec2 TexCoord;
 	};
 	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
+	ChunkSpan< Vertex > data;
 
 	//read + upload data chunk:
 	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
+		data = file.read< Vertex >("pnct");
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		//data is uploaded by upload():
+		pending_data = data.data();
+		pending_bytes = data.bytes();
 
 		total = GLuint(data.size()); //store total for later checks on index
 
@@ -47,8 +47,28 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
 
-	std::vector< char > strings;
-	read_chunk(file, "str0", &strings);
+	//read (optional) index chunk -- if present, mesh ranges are ranges of indices:
+	GLenum index_type = 0;
+	std::vector< uint32_t > indices; //(copied out, for computing bounds)
+	auto read_indices = [&](auto span) {
+		pending_indices = span.data();
+		pending_index_bytes = span.bytes();
+		indices.assign(span.begin(), span.end());
+		for (uint32_t i : indices) {
+			if (i >= total) throw std::runtime_error("index chunk in '" + filename + "' has out-of-range vertex index");
+		}
+	};
+	if (file.next_is("ix16")) {
+		index_type = GL_UNSIGNED_SHORT;
+		read_indices(file.read< uint16_t >("ix16"));
+	} else if (file.next_is("ix32")) {
+		index_type = GL_UNSIGNED_INT;
+		read_indices(file.read< uint32_t >("ix32"));
+	}
+	//meshes are ranges of these:
+	GLuint range = (index_type ? GLuint(indices.size()) : total);
+
+	ChunkSpan< char > strings = file.read< char >("str0");
 
 	{ //read index chunk, add to meshes:
 		struct IndexEntry {
@@ -57,56 +77,97 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		};
 		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
 
-		std::vector< IndexEntry > index;
-		read_chunk(file, "idx0", &index);
+		ChunkSpan< IndexEntry > index = file.read< IndexEntry >("idx0");
 
 		for (auto const &entry : index) {
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
 				throw std::runtime_error("index entry has out-of-range name begin/end");
 			}
-			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= range)) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
-			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+			std::string name(strings.begin() + entry.name_begin, strings.begin() + entry.name_end);
 			Mesh mesh;
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
-			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+			mesh.index_type = index_type;
+			for (uint32_t i = entry.vertex_begin; i < entry.vertex_end; ++i) {
+				uint32_t v = (index_type ? indices[i] : i);
 				mesh.min = glm::min(mesh.min, data[v].Position);
 				mesh.max = glm::max(mesh.max, data[v].Position);
 			}
-			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
+			bool inserted = meshes.insert(name, mesh);
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
 			}
 		}
 	}
 
-	if (file.peek() != EOF) {
+	if (!file.at_end()) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
-	for (auto const &m : meshes) {
-		if (&m.second == &meshes.rbegin()->second && meshes.size() > 1) std::cout << " and";
-		std::cout << " '" << m.first << "'";
-		if (&m.second != &meshes.rbegin()->second) std::cout << ",";
+	for (auto const &m : meshes.entries) {
+		if (&m == &meshes.entries.back() && meshes.size() > 1) std::cout << " and";
+		std::cout << " '" << m.name << "'";
+		if (&m != &meshes.entries.back()) std::cout << ",";
 	}
 	std::cout << std::endl;
 	*/
+
+	if (when == UploadNow) upload();
+}
+
+MeshBuffer::~MeshBuffer() {
+	//(so that unloading a MeshBuffer -- e.g., from a LazyLoad -- frees its vertex data)
+	if (buffer != 0) {
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+	if (index_buffer != 0) {
+		glDeleteBuffers(1, &index_buffer);
+		index_buffer = 0;
+	}
+}
+
+void MeshBuffer::upload() {
+	if (!pending_file) return; //already uploaded
+	PROFILE_ZONE("MeshBuffer::upload");
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, pending_bytes, pending_data, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (pending_indices) {
+		glGenBuffers(1, &index_buffer);
+		//(binding GL_ELEMENT_ARRAY_BUFFER changes the bound vertex array object's state, so make sure none is bound)
+		glBindVertexArray(0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, pending_index_bytes, pending_indices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	//(the mapping is no longer needed)
+	pending_file.reset();
+	pending_data = nullptr;
+	pending_bytes = 0;
+	pending_indices = nullptr;
+	pending_index_bytes = 0;
 }
 
-const Mesh &MeshBuffer::lookup(std::string const &name) const {
-	auto f = meshes.find(name);
-	if (f == meshes.end()) {
-		throw std::runtime_error("Looking up mesh '" + name + "' that doesn't exist.");
+const Mesh &MeshBuffer::lookup(HashedName const &name) const {
+	Mesh const *mesh = meshes.find(name);
+	if (!mesh) {
+		throw std::runtime_error("Looking up mesh '" + name.str() + "' that doesn't exist.");
 	}
-	return f->second;
+	return *mesh;
 }
 
-GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+GLuint MeshBuffer::make_vao_for_program(GLuint program, std::function< void(GLuint program, std::set< GLuint > *bound) > const &bind_extra) const {
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
@@ -128,6 +189,9 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	bind_attribute("Color", Color);
 	bind_attribute("TexCoord", TexCoord);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//(the element buffer binding is part of the vertex array object's state)
+	if (index_buffer != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	if (bind_extra) bind_extra(program, &bound);
 	glBindVertexArray(0);
 
 	//Check that all active attributes were bound:
@@ -5,23 +5,32 @@
  *  the OpenGL pipeline together.
  * A "MeshBuffer" holds a collection of such meshes (loaded from a file) in
  *  a single OpenGL array buffer. Individual meshes can be looked up by name
- *  using the MeshBuffer::lookup() function.
+ *  using the MeshBuffer::lookup() function (names may be pre-hashed; see HashedName.hpp).
+ *
+ * Files may also have an index chunk (see the 'index-meshes' tool), in which case
+ *  meshes are ranges of indices into the buffer's shared vertices instead.
  *
  */
 
 #include "GL.hpp"
+#include "HashedName.hpp"
 #include <glm/glm.hpp>
-#include <map>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <set>
 #include <string>
 
+struct ChunkFile;
+
 
 struct Mesh {
 	//Meshes are vertex ranges (and primitive types) in their MeshBuffer:
 
 	GLenum type = GL_TRIANGLES; //type of primitives in mesh
-	GLuint start = 0; //index of first vertex
-	GLuint count = 0; //count of vertices
+	GLuint start = 0; //index of first vertex (or, if indexed, first index)
+	GLuint count = 0; //count of vertices (or, if indexed, indices)
+	GLenum index_type = 0; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT for indexed meshes; 0 if not indexed
 
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
@@ -32,23 +41,47 @@ struct Mesh {
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	// with UploadLater, doesn't use OpenGL (so can run on a loading thread); call upload() on the OpenGL thread before drawing.
+	enum Upload { UploadNow, UploadLater };
+	MeshBuffer(std::string const &filename, Upload when = UploadNow);
+	~MeshBuffer(); //(deletes 'buffer' and 'index_buffer'; vertex arrays made by make_vao_for_program are up to their owners)
+
+	//buffers aren't copyable:
+	MeshBuffer(MeshBuffer const &) = delete;
+	MeshBuffer &operator=(MeshBuffer const &) = delete;
+
+	//copy vertex data (read by the constructor) into 'buffer' (and index data into 'index_buffer'):
+	void upload();
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
-	const Mesh &lookup(std::string const &name) const;
+	const Mesh &lookup(HashedName const &name) const;
 	
 	//build a vertex array object that links this vbo to attributes to a program:
 	// note: will throw if program defines attributes not contained in this buffer
-	GLuint make_vao_for_program(GLuint program) const;
+	// 'bind_extra' (optional) is called with the vao bound to set up any additional attributes (e.g., Scene::bind_instance_attributes);
+	//  it should add the locations it binds to the passed set.
+	GLuint make_vao_for_program(GLuint program,
+		std::function< void(GLuint program, std::set< GLuint > *bound) > const &bind_extra = nullptr
+	) const;
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
+	//...and, for files with an index chunk, the element buffer holding indices (bound in vaos made by make_vao_for_program):
+	GLuint index_buffer = 0;
+
+	//vertex and index data waiting for upload() (in the mapped file):
+	std::unique_ptr< ChunkFile > pending_file;
+	void const *pending_data = nullptr;
+	size_t pending_bytes = 0;
+	void const *pending_indices = nullptr;
+	size_t pending_index_bytes = 0;
 
 	//-- internals ---
 
 	//used by the lookup() function:
-	std::map< std::string, Mesh > meshes;
+	// (meshes.entries lists all meshes, in file order)
+	FlatNameMap< Mesh > meshes;
 
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
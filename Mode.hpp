@@ -13,12 +13,34 @@ struct Mode : std::enable_shared_from_this< Mode > {
 	//The function should return 'true' if it handled the event.
 	virtual bool handle_event(SDL_Event const &, glm::uvec2 const &window_size) { return false; }
 
-	//update is called at the start of a new frame, after events are handled:
+	//update is called after events are handled, zero or more times per frame:
 	// 'elapsed' is time in seconds since the last call to 'update'
+	// (the game's main loop always steps by exactly Mode::UpdateStep, so simulation doesn't depend on frame rate)
 	virtual void update(float elapsed, bool *quit) { }
-
-	//draw is called after update:
-	virtual void draw(glm::uvec2 const &drawable_size) = 0;
+	static constexpr float UpdateStep = 1.0f / 120.0f;
+
+	//draw is called once per frame, after update:
+	// 'alpha' in [0,1] is how far the current time is past the last update, as a fraction of UpdateStep
+	// (a mode that moves things smoothly can draw them 'alpha' of the way from their previous to their current state;
+	//  callers that update with variable time steps pass 1.0f)
+	virtual void draw(glm::uvec2 const &drawable_size, float alpha) = 0;
+
+	//----- threaded update (optional) -----
+	//When the game is run with --threaded-update, modes that support it are updated on a simulation thread,
+	// while the main thread handles events (with the mode locked) and draws the latest Snapshot the mode published.
+	//A snapshot holds an immutable copy of everything needed to draw one update's worth of state:
+	struct Snapshot {
+		virtual ~Snapshot() { }
+	};
+
+	//snapshot is called after update (on the thread that called update):
+	// a mode that supports threaded update returns a new snapshot of its current state
+	// (the default returns nullptr, which means the mode is always updated on the main thread)
+	virtual std::shared_ptr< Snapshot const > snapshot(glm::uvec2 const &drawable_size) { return nullptr; }
+
+	//draw_snapshot is called on the main thread, *while update runs on the simulation thread*,
+	// so it must only read from the snapshot (and never from the mode's own state):
+	virtual void draw_snapshot(Snapshot const &snapshot, glm::uvec2 const &drawable_size, float alpha) { }
 
 	//Mode::current is the Mode to which events are dispatched.
 	// use 'set_current' to change the current Mode (e.g., to switch to a menu)
@@ -10,77 +10,104 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <list>
 #include <random>
 #include <time.h>
 
-GLuint pentaton_meshes_for_lit_color_texture_program = 0;
-Load< MeshBuffer > pentaton_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("pentaton.pnct"));
-	pentaton_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret;
+//pentaton meshes only use vertex colors, and PlayMode lights the scene with just a sky light,
+// so they are drawn with a specialized variant of the lit color texture program:
+static LitColorTextureProgram const &pentaton_program(bool instanced) {
+	LitColorTextureProgram::Variant variant;
+	variant.instanced = instanced;
+	variant.textured = false;
+	variant.light_types = LitColorTextureProgram::HemisphereLights;
+	return lit_color_texture_program_variant(variant);
+}
+
+//template for pentaton drawables' pipelines (set once the meshes are uploaded):
+static Scene::Drawable::Pipeline pentaton_pipeline;
+
+//(mesh data is read on a loading thread, then uploaded on the main thread)
+Load< MeshBuffer > pentaton_meshes({ &lit_color_texture_program }, []() -> MeshBuffer * {
+	return new MeshBuffer(data_path("pentaton.pnct"), MeshBuffer::UploadLater);
+}, [](MeshBuffer *meshes) {
+	meshes->upload();
+
+	pentaton_pipeline = lit_color_texture_program_pipeline;
+	pentaton_pipeline.program = pentaton_program(false).program;
+	pentaton_pipeline.instanced_program = pentaton_program(true).program;
+	pentaton_pipeline.textures[0].texture = 0; //(untextured)
+	pentaton_pipeline.vao = meshes->make_vao_for_program(pentaton_pipeline.program);
+	pentaton_pipeline.instanced_vao = meshes->make_vao_for_program(pentaton_pipeline.instanced_program, Scene::bind_instance_attributes);
 });
 
-Load< Scene > pentaton_scene(LoadTagDefault, []() -> Scene const * {
+//(the scene doesn't need OpenGL, so loads entirely on a loading thread)
+Load< Scene > pentaton_scene({ &pentaton_meshes }, []() -> Scene * {
 	return new Scene(data_path("pentaton.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
 		Mesh const &mesh = pentaton_meshes->lookup(mesh_name);
 
 		scene.drawables.emplace_back(transform);
 		Scene::Drawable &drawable = scene.drawables.back();
 
-		drawable.pipeline = lit_color_texture_program_pipeline;
+		drawable.pipeline = pentaton_pipeline;
 
-		drawable.pipeline.vao = pentaton_meshes_for_lit_color_texture_program;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.min = mesh.min;
+		drawable.pipeline.max = mesh.max;
 
 	});
 });
 
 
 // Load samples!
-Load< std::vector<std::vector<Sound::Sample>> > PentaSamples(LoadTagDefault, []() -> std::vector<std::vector<Sound::Sample>> const* {
-	return new std::vector< std::vector<Sound::Sample>>({
-		std::vector <Sound::Sample> {
-			Sound::Sample(data_path("Audio/PianoFB/F3.wav")),
-			Sound::Sample(data_path("Audio/PianoFB/G3.wav")),
-			Sound::Sample(data_path("Audio/PianoFB/A3.wav")),
-			Sound::Sample(data_path("Audio/PianoFB/C4.wav")),
-			Sound::Sample(data_path("Audio/PianoFB/D4.wav")),
-		},
-		std::vector <Sound::Sample> {
-			Sound::Sample(data_path("Audio/PickedBassYR/F.wav")),
-			Sound::Sample(data_path("Audio/PickedBassYR/G.wav")),
-			Sound::Sample(data_path("Audio/PickedBassYR/A.wav")),
-			Sound::Sample(data_path("Audio/PickedBassYR/C.wav")),
-			Sound::Sample(data_path("Audio/PickedBassYR/D.wav")),
-		},
-		std::vector <Sound::Sample> {
-			Sound::Sample(data_path("Audio/ColomboADK/BassDrum-HV1.wav")),
-			Sound::Sample(data_path("Audio/ColomboADK/ClosedHiHat-1.wav")),
-			Sound::Sample(data_path("Audio/ColomboADK/OpenHiHat-1.wav")),
-			Sound::Sample(data_path("Audio/ColomboADK/SnareDrum1-HV1.wav")),
-			Sound::Sample(data_path("Audio/ColomboADK/SideStick-1.wav")),
-		},
-		std::vector <Sound::Sample> {
-			Sound::Sample(data_path("Audio/SpanishClassicalGuitar/F3.wav")),
-			Sound::Sample(data_path("Audio/SpanishClassicalGuitar/G3.wav")),
-			Sound::Sample(data_path("Audio/SpanishClassicalGuitar/A3.wav")),
-			Sound::Sample(data_path("Audio/SpanishClassicalGuitar/C4.wav")),
-			Sound::Sample(data_path("Audio/SpanishClassicalGuitar/D4.wav")),
-		},
-		std::vector <Sound::Sample> {
-			Sound::Sample(data_path("Audio/AdVoca/F.wav")),
-			Sound::Sample(data_path("Audio/AdVoca/G.wav")),
-			Sound::Sample(data_path("Audio/AdVoca/A.wav")),
-			Sound::Sample(data_path("Audio/AdVoca/C.wav")),
-			Sound::Sample(data_path("Audio/AdVoca/D.wav")),
-		},
-	});
+// (each sample is its own load, so decoding is spread over the loading threads)
+static std::vector< std::vector< char const * > > const penta_sample_files = {
+	{ "Audio/PianoFB/F3.wav", "Audio/PianoFB/G3.wav", "Audio/PianoFB/A3.wav", "Audio/PianoFB/C4.wav", "Audio/PianoFB/D4.wav" },
+	{ "Audio/PickedBassYR/F.wav", "Audio/PickedBassYR/G.wav", "Audio/PickedBassYR/A.wav", "Audio/PickedBassYR/C.wav", "Audio/PickedBassYR/D.wav" },
+	{ "Audio/ColomboADK/BassDrum-HV1.wav", "Audio/ColomboADK/ClosedHiHat-1.wav", "Audio/ColomboADK/OpenHiHat-1.wav", "Audio/ColomboADK/SnareDrum1-HV1.wav", "Audio/ColomboADK/SideStick-1.wav" },
+	{ "Audio/SpanishClassicalGuitar/F3.wav", "Audio/SpanishClassicalGuitar/G3.wav", "Audio/SpanishClassicalGuitar/A3.wav", "Audio/SpanishClassicalGuitar/C4.wav", "Audio/SpanishClassicalGuitar/D4.wav" },
+	{ "Audio/AdVoca/F.wav", "Audio/AdVoca/G.wav", "Audio/AdVoca/A.wav", "Audio/AdVoca/C.wav", "Audio/AdVoca/D.wav" },
+};
+
+//(a list, since each Load<> must stay where it was constructed)
+static std::list< Load< Sound::Sample > > penta_sample_loads;
+
+static std::vector< LoadBase const * > const penta_sample_dependencies = []() {
+	std::vector< LoadBase const * > dependencies;
+	for (auto const &instrument : penta_sample_files) {
+		for (char const *file : instrument) {
+			penta_sample_loads.emplace_back(std::vector< LoadBase const * >(), [file]() -> Sound::Sample * {
+				return new Sound::Sample(data_path(file));
+			});
+			dependencies.emplace_back(&penta_sample_loads.back());
+		}
+	}
+	return dependencies;
+}();
+
+//samples by instrument, then tone:
+Load< std::vector< std::vector< Sound::Sample const * > > > PentaSamples(penta_sample_dependencies, []() -> std::vector< std::vector< Sound::Sample const * > > * {
+	auto *ret = new std::vector< std::vector< Sound::Sample const * > >();
+	auto load = penta_sample_loads.begin();
+	for (auto const &instrument : penta_sample_files) {
+		ret->emplace_back();
+		for (size_t i = 0; i < instrument.size(); ++i) {
+			ret->back().emplace_back(load->value);
+			++load;
+		}
+	}
+	return ret;
 });
 
 
-PlayMode::PlayMode() : scene(*pentaton_scene) {
+PlayMode::PlayMode() {
+	// Share the loaded scene rather than copying it; only the objects this mode changes get copied
+	// (pentaton_scene owns the Scene, so the shared pointer must not delete it)
+	scene.instantiate(std::shared_ptr< Scene const >(pentaton_scene.value, [](Scene const *) { }));
+
 	// First, seed the random number generator
 	std::srand((unsigned int)time(NULL));
 
@@ -91,21 +118,20 @@ PlayMode::PlayMode() : scene(*pentaton_scene) {
 	//editableNBs = &noteBlocks;
 
 	//get pointers to scene objects
-	for (auto &transform : scene.transforms) {
-		if (transform.name == "Question Mark") question_mark = &transform;
-		if (transform.name == "Check Mark") check_mark = &transform;
-	}
+	question_mark = scene.base->find_transform("Question Mark");
+	check_mark = scene.base->find_transform("Check Mark");
 	if (question_mark == nullptr) throw std::runtime_error("question_mark not found.");
 	if (check_mark == nullptr) throw std::runtime_error("check_mark not found.");
 
 	// Get pointers to prefabs
-	for (auto &drawable : scene.drawables) {
-		for (ShapeDef shapeDef : shapeDefs) {
-			for (ColorDef colorDef : colorDefs) {
-				if (drawable.transform->name == shapeDef.name + colorDef.name) {
-					setPrefab(shapeDef.shape, colorDef.color, &drawable);
-				}
-			}
+	// (prefabs are only templates for note blocks, so they are hidden -- otherwise they'd be transformed and drawn every frame)
+	for (ShapeDef const &shapeDef : shapeDefs) {
+		for (ColorDef const &colorDef : colorDefs) {
+			Scene::Transform const *transform = scene.base->find_transform(shapeDef.name + colorDef.name);
+			if (!transform) continue;
+			Scene::Drawable const *prefab = scene.base->find_drawable(transform);
+			setPrefab(shapeDef.shape, colorDef.color, prefab);
+			if (prefab) scene.modify(prefab)->visible = false;
 		}
 	}
 	// Check if vectors are null
@@ -118,9 +144,21 @@ PlayMode::PlayMode() : scene(*pentaton_scene) {
 		}
 	}
 
-	// Init some standard values
-	question_mark_scale = question_mark->scale;
-	check_mark_scale = check_mark->scale;
+	// Gather the drawables that make up each mark (including child parts); these get shown/hidden, so need their own copies
+	for (auto const &drawable : scene.base->drawables) {
+		for (Scene::Transform const *t = drawable.transform; t != nullptr; t = t->parent) {
+			if (t == question_mark) question_mark_drawables.emplace_back(scene.modify(&drawable));
+			if (t == check_mark) check_mark_drawables.emplace_back(scene.modify(&drawable));
+		}
+	}
+
+	//the game has always been lit by just a soft light from above, so the scene's own lights (a lamp) are left out:
+	// (new transforms point along -z, so this light's direction is (0,0,-1))
+	scene.lights.clear();
+	scene.transforms.emplace_back();
+	scene.lights.emplace_back(&scene.transforms.back());
+	scene.lights.back().type = Scene::Light::Hemisphere;
+	scene.lights.back().energy = glm::vec3(1.0f, 1.0f, 0.95f);
 
 	//get pointer to camera for convenience:
 	if (scene.cameras.size() != 1) throw std::runtime_error("Expecting scene to have exactly one camera, but it has " + std::to_string(scene.cameras.size()));
@@ -291,16 +329,11 @@ void PlayMode::update(float elapsed, bool *quit) {
 
 
 	// Update based on playingTargetAudio
-	if (playingTargetAudio) {
-		question_mark->scale = question_mark_scale;
-	} else {
-		question_mark->scale = glm::vec3(0.0f);
+	for (Scene::Drawable *drawable : question_mark_drawables) {
+		drawable->visible = playingTargetAudio;
 	}
-
-	if (playingLvlFinalLoop) {
-		check_mark->scale = check_mark_scale;
-	} else {
-		check_mark->scale = glm::vec3(0.0f);
+	for (Scene::Drawable *drawable : check_mark_drawables) {
+		drawable->visible = playingLvlFinalLoop;
 	}
 
 
@@ -345,18 +378,35 @@ void PlayMode::update(float elapsed, bool *quit) {
 	space.downs = 0;
 }
 
-void PlayMode::draw(glm::uvec2 const &drawable_size) {
+//(PlayMode ignores 'alpha': nothing in it moves smoothly -- note blocks jump between grid cells and the marks are only shown or hidden,
+// so drawing part-way between two updates would only blur those jumps)
+void PlayMode::draw(glm::uvec2 const &drawable_size, float alpha) {
+	make_snapshot(drawable_size, &frame_snapshot);
+	draw_snapshot(frame_snapshot, drawable_size, alpha);
+}
+
+std::shared_ptr< Mode::Snapshot const > PlayMode::snapshot(glm::uvec2 const &drawable_size) {
+	auto snapshot = std::make_shared< PlaySnapshot >();
+	make_snapshot(drawable_size, snapshot.get());
+	//(noteblock drawables may be deleted by the next update, while this snapshot is being drawn)
+	snapshot->draw_list.own_pipelines();
+	return snapshot;
+}
+
+void PlayMode::make_snapshot(glm::uvec2 const &drawable_size, PlaySnapshot *snapshot) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	GL_ERRORS();
-	glUseProgram(0);
+	scene.build_draw_list(*camera, &snapshot->draw_list);
+
+	snapshot->level = current_lvl;
+	snapshot->level_complete = playingLvlFinalLoop;
+	snapshot->freeplay = freeplay;
+	snapshot->show_controls = showControls;
+}
+
+void PlayMode::draw_snapshot(Snapshot const &snapshot_, glm::uvec2 const &drawable_size, float alpha) {
+	PlaySnapshot const &snapshot = static_cast< PlaySnapshot const & >(snapshot_);
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
@@ -365,7 +415,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS); //this is the default depth comparison function, but FYI you can change it.
 
-	scene.draw(*camera);
+	Scene::submit(snapshot.draw_list);
 
 	{ //use DrawLines to overlay some text:
 		glDisable(GL_DEPTH_TEST);
@@ -381,9 +431,9 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 		float ofs = 2.0f / drawable_size.y;
 
 		// Level/freeplay text
-		std::string str = "Level " + std::to_string(current_lvl + 1);
-		if (playingLvlFinalLoop) str += " complete!";
-		if (freeplay) str = "Freeplay";
+		std::string str = "Level " + std::to_string(snapshot.level + 1);
+		if (snapshot.level_complete) str += " complete!";
+		if (snapshot.freeplay) str = "Freeplay";
 		lines.draw_text(str,
 			glm::vec3(-aspect + 0.1f * H, 1.0f - 1.1f * H, 0.0),
 			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
@@ -394,8 +444,8 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 			glm::u8vec4(0xff, 0xff, 0xff, 0x00));
 
 		// Controls text
-		if (showControls) {
-			if (freeplay) {
+		if (snapshot.show_controls) {
+			if (snapshot.freeplay) {
 				lines.draw_text("Arrow keys to cycle the origin shape/color",
 					glm::vec3(-aspect + 0.1f * H, -1.0f + 4.9f * H, 0.0),
 					glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
@@ -415,7 +465,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
 				glm::u8vec4(0xff, 0xff, 0xff, 0x00));
 
-			if (!freeplay) {
+			if (!snapshot.freeplay) {
 				lines.draw_text("Hold space to hear the goal",
 					glm::vec3(-aspect + 0.1f * H, -1.0f + 2.5f * H, 0.0),
 					glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
@@ -535,7 +585,7 @@ void PlayMode::playNote(NoteBlock& nB, size_t targetNote) {
 		size_t instrument = nB.gridPos.x;
 		size_t tone = (nB.gridPos.y + nB.shapeDef->tone_offsets[targetTone]) % GRID_HEIGHT;
 		//std::cout << "instrument: " << instrument << ". tone: " << tone << std::endl;
-		nB.currentSample = Sound::play_3D(PentaSamples->at(instrument).at(tone), 1.0f, nB.transform->position, 10.0f);
+		nB.currentSample = Sound::play_3D(*PentaSamples->at(instrument).at(tone), 1.0f, nB.transform->position, 10.0f);
 	//} else if (nB.shapeDef->shape == SHAPE::CONE) { // CONE shifts its column upward
 	//	shiftNoteBlocks(0, 1, nB.gridPos.x, -1);
 	//} else if (nB.shapeDef->shape == SHAPE::TORUS) { // TORUS rotates the blocks around it
@@ -17,7 +17,9 @@ struct PlayMode : Mode {
 	//functions called by main loop:
 	virtual bool handle_event(SDL_Event const &, glm::uvec2 const &window_size) override;
 	virtual void update(float elapsed, bool *quit) override;
-	virtual void draw(glm::uvec2 const &drawable_size) override;
+	virtual void draw(glm::uvec2 const &drawable_size, float alpha) override;
+	virtual std::shared_ptr< Snapshot const > snapshot(glm::uvec2 const &drawable_size) override;
+	virtual void draw_snapshot(Snapshot const &, glm::uvec2 const &drawable_size, float alpha) override;
 
 
 	//----- SETTINGS -----
@@ -49,15 +51,29 @@ struct PlayMode : Mode {
 
 	bool playingTargetAudio = false;
 	bool playingLvlFinalLoop = false;
-	glm::vec3 question_mark_scale;
-	glm::vec3 check_mark_scale;
 
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
 
+	//everything draw_snapshot() needs to draw a frame:
+	struct PlaySnapshot : Snapshot {
+		Scene::DrawList draw_list;
+		int level = 0;
+		bool level_complete = false;
+		bool freeplay = false;
+		bool show_controls = true;
+	};
+	void make_snapshot(glm::uvec2 const &drawable_size, PlaySnapshot *snapshot);
+	//(draw() re-uses the same snapshot every frame, which avoids re-allocating its storage)
+	PlaySnapshot frame_snapshot;
+
 	// Scene Transforms
-	Scene::Transform *question_mark = nullptr;
-	Scene::Transform* check_mark = nullptr;
+	// (these belong to the shared base scene, so are read-only)
+	Scene::Transform const *question_mark = nullptr;
+	Scene::Transform const *check_mark = nullptr;
+	// Drawables attached to the marks (or their children), shown/hidden as a group
+	std::vector< Scene::Drawable * > question_mark_drawables;
+	std::vector< Scene::Drawable * > check_mark_drawables;
 
 
 	// ----- SHAPES AND COLORS -----
@@ -117,19 +133,19 @@ struct PlayMode : Mode {
 	const float SHIFTBLOCK_T_OFFSET = 0.25f; // The time offset for when shiftblocks do their shift
 
 	// 2d vector of basic shapes/colors to duplicate
-	std::vector<std::vector<Scene::Drawable*>> prefabs;
+	std::vector<std::vector<Scene::Drawable const *>> prefabs;
 
 	void initPrefabVectors() {
-		prefabs = std::vector<std::vector<Scene::Drawable*>>(int(SHAPE::END));
+		prefabs = std::vector<std::vector<Scene::Drawable const *>>(int(SHAPE::END));
 		for (size_t i = 0; i < prefabs.size(); i++) {
-			prefabs[i] = std::vector<Scene::Drawable*>(int(COLOR::END), nullptr);
+			prefabs[i] = std::vector<Scene::Drawable const *>(int(COLOR::END), nullptr);
 		}
 	}
 
-	Scene::Drawable* getPrefab(SHAPE s, COLOR c) {
+	Scene::Drawable const *getPrefab(SHAPE s, COLOR c) {
 		return prefabs[int(s)][int(c)];
 	}
-	void setPrefab(SHAPE s, COLOR c, Scene::Drawable *drawable) {
+	void setPrefab(SHAPE s, COLOR c, Scene::Drawable const *drawable) {
 		prefabs[int(s)][int(c)] = drawable;
 	}
 
@@ -140,6 +156,7 @@ struct PlayMode : Mode {
 		ShapeDef *shapeDef = nullptr;
 		ColorDef *colorDef = nullptr;
 		Scene::Transform *transform = nullptr;
+		Scene::Drawable *drawable = nullptr;
 		glm::uvec2 gridPos = { 0, 0 }; // position in the grid. 0 <= x, y < 5
 		std::shared_ptr< Sound::PlayingSample > currentSample = nullptr;
 		//size_t last_tone_index = -1;
@@ -193,7 +210,7 @@ struct PlayMode : Mode {
 	// https://github.com/lassyla/game2/blob/master/FishMode.cpp?fbclid=IwAR2gXxc_Omje47Xa7JmJPRN6Nh2jGSEnMVn1Qw7uoSV0QwKu0ZwwAUu5528
 	NoteBlock* createNewNoteBlock(nbVec *nBs_to_create_in, SHAPE s, COLOR c, glm::uvec2 gridPos) {
 		//std::cout << "createNewNoteBlock() called" << std::endl;
-		Scene::Drawable *prefabDrawable = getPrefab(s, c);
+		Scene::Drawable const *prefabDrawable = getPrefab(s, c);
 
 		NoteBlock *nB = &(*nBs_to_create_in).at(gridPos.x).at(gridPos.y);
 		if (nB->transform != nullptr) throw std::runtime_error("Tried to create new note block over an existing block");
@@ -205,12 +222,14 @@ struct PlayMode : Mode {
 		nB->transform->position = prefabDrawable->transform->position;
 		nB->transform->rotation = prefabDrawable->transform->rotation;
 		nB->transform->scale = prefabDrawable->transform->scale;
-		if (nBs_to_create_in == &targetNoteBlocks) nB->transform->scale = glm::vec3(0.0f);
 		nB->gridPos = gridPos;
 
 		scene.drawables.emplace_back(nB->transform);
 		Scene::Drawable &drawable = scene.drawables.back();
-		drawable.pipeline = prefabDrawable->pipeline;
+		drawable.pipeline = prefabDrawable->drawn_pipeline();
+		// Target blocks are only ever heard, never seen
+		drawable.visible = (nBs_to_create_in != &targetNoteBlocks);
+		nB->drawable = &drawable;
 		//std::cout << "createNewNoteBlock() returning" << std::endl;
 		return nB;
 	}
@@ -322,12 +341,10 @@ struct PlayMode : Mode {
 		for (auto nBColIter = nBs.begin(); nBColIter != nBs.end(); nBColIter++) {
 			for (auto nBIter = nBColIter->begin(); nBIter != nBColIter->end(); nBIter++) {
 				if (nBIter->transform != nullptr) {
-					if (playingTargetAudio != targetNBs) {
-						nBIter->transform->position = glm::vec3(100.0f, 100.0f, 100.0f);
-					} else {
-						nBIter->transform->position = NOTEBLOCK_ORIGIN +
-							glm::vec3(nBIter->gridPos.x * NOTEBLOCK_DELTA.x, nBIter->gridPos.y * NOTEBLOCK_DELTA.y, 0.0f);
-					}
+					nBIter->transform->position = NOTEBLOCK_ORIGIN +
+						glm::vec3(nBIter->gridPos.x * NOTEBLOCK_DELTA.x, nBIter->gridPos.y * NOTEBLOCK_DELTA.y, 0.0f);
+					// Player blocks are hidden while the target is playing; target blocks are never shown
+					nBIter->drawable->visible = !targetNBs && !playingTargetAudio;
 				}
 			}
 		}
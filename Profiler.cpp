@@ -0,0 +1,148 @@
+#include "Profiler.hpp"
+
+#if PROFILER_ENABLED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+	struct Zone {
+		char const *name;
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	//zones recorded by one thread:
+	struct Ring {
+		static constexpr uint32_t Size = 1 << 15; //(power of two)
+		Zone zones[Size]; //(left uninitialized, so threads that record little don't touch much memory)
+		std::atomic< uint64_t > recorded{0}; //total zones ever recorded; zone i is at zones[i % Size]
+		uint32_t tid = 0;
+		std::string thread_name; //(guarded by the registry's mutex)
+	};
+
+	struct Registry {
+		std::mutex mutex;
+		std::vector< std::unique_ptr< Ring > > rings; //(rings outlive their threads, so zones from finished threads can still be written)
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	};
+
+	Registry &get_registry() {
+		static Registry registry;
+		return registry;
+	}
+
+	Ring &get_ring() {
+		thread_local Ring *ring = nullptr;
+		if (!ring) {
+			Registry &registry = get_registry();
+			std::unique_lock< std::mutex > lock(registry.mutex);
+			registry.rings.emplace_back(new Ring);
+			ring = registry.rings.back().get();
+			ring->tid = uint32_t(registry.rings.size());
+		}
+		return *ring;
+	}
+
+	//write 'str' as a JSON string:
+	void write_json_string(std::ostream &out, std::string const &str) {
+		out << '"';
+		for (char c : str) {
+			if (c == '"' || c == '\\') out << '\\' << c;
+			else if (uint8_t(c) < 0x20) out << ' ';
+			else out << c;
+		}
+		out << '"';
+	}
+}
+
+uint64_t profiler_now() {
+	return uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - get_registry().start).count());
+}
+
+void profiler_record(char const *name, uint64_t begin, uint64_t end) {
+	Ring &ring = get_ring();
+	uint64_t index = ring.recorded.load(std::memory_order_relaxed);
+	ring.zones[index % Ring::Size] = Zone{name, begin, end};
+	ring.recorded.store(index + 1, std::memory_order_release);
+}
+
+void profiler_set_thread_name(std::string const &name) {
+	Ring &ring = get_ring();
+	Registry &registry = get_registry();
+	std::unique_lock< std::mutex > lock(registry.mutex);
+	ring.thread_name = name;
+}
+
+bool profiler_write_trace(std::string const &filename) {
+	PROFILE_ZONE("profiler_write_trace");
+
+	//copy zones out of the rings (other threads keep recording in the meantime):
+	struct Thread {
+		uint32_t tid;
+		std::string name;
+		std::vector< Zone > zones;
+	};
+	std::vector< Thread > threads;
+	{
+		Registry &registry = get_registry();
+		std::unique_lock< std::mutex > lock(registry.mutex);
+		for (auto const &ring : registry.rings) {
+			threads.emplace_back();
+			Thread &thread = threads.back();
+			thread.tid = ring->tid;
+			thread.name = ring->thread_name;
+
+			uint64_t end = ring->recorded.load(std::memory_order_acquire);
+			uint64_t begin = (end > Ring::Size ? end - Ring::Size : 0);
+			thread.zones.reserve(size_t(end - begin));
+			for (uint64_t i = begin; i < end; ++i) {
+				thread.zones.emplace_back(ring->zones[i % Ring::Size]);
+			}
+			//zones that were overwritten while being copied can't be trusted:
+			uint64_t after = ring->recorded.load(std::memory_order_acquire);
+			if (after > Ring::Size && after - Ring::Size > begin) {
+				size_t stale = size_t(std::min(after - Ring::Size, end) - begin);
+				thread.zones.erase(thread.zones.begin(), thread.zones.begin() + stale);
+			}
+		}
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) {
+		std::cerr << "Failed to open '" << filename << "' to write trace." << std::endl;
+		return false;
+	}
+
+	//trace-event format ("X" = complete event, times in microseconds):
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	for (Thread const &thread : threads) {
+		if (!thread.name.empty()) {
+			out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.tid << ",\"args\":{\"name\":";
+			write_json_string(out, thread.name);
+			out << "}}";
+			first = false;
+		}
+		for (Zone const &zone : thread.zones) {
+			out << (first ? "" : ",\n") << "{\"name\":";
+			write_json_string(out, zone.name);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.tid
+			    << ",\"ts\":" << (zone.begin / 1000) << '.' << (zone.begin / 100 % 10)
+			    << ",\"dur\":" << ((zone.end - zone.begin) / 1000) << '.' << ((zone.end - zone.begin) / 100 % 10)
+			    << "}";
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+
+	return bool(out);
+}
+
+#endif //PROFILER_ENABLED
@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+ * A low-overhead profiler that records timed "zones" on every thread and
+ *  writes them out as a Chrome trace (load the file in chrome://tracing or
+ *  https://ui.perfetto.dev to see a timeline).
+ *
+ * Usage:
+ *   void Scene::draw(...) {
+ *       PROFILE_ZONE("Scene::draw"); //times from here to the end of the enclosing scope
+ *       ...
+ *   }
+ *
+ *   profiler_set_thread_name("audio"); //(optional) label the calling thread in the trace
+ *
+ *   profiler_write_trace("trace.json"); //write the most recent zones from all threads
+ *
+ * Each thread records into its own fixed-size ring buffer (so recording
+ *  never locks or allocates, and the oldest zones are overwritten).
+ *
+ * Building with PROFILER_ENABLED defined as 0 compiles all of this out.
+ *
+ */
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#include <cstdint>
+#include <string>
+
+#if PROFILER_ENABLED
+
+//time since the profiler started, in nanoseconds:
+uint64_t profiler_now();
+
+//record a zone that ran from 'begin' to 'end' on the calling thread:
+// (name must be a string that lives forever -- e.g., a literal)
+void profiler_record(char const *name, uint64_t begin, uint64_t end);
+
+struct ProfileZone {
+	ProfileZone(char const *name_) : name(name_), begin(profiler_now()) { }
+	~ProfileZone() { profiler_record(name, begin, profiler_now()); }
+	char const *name;
+	uint64_t begin;
+
+	ProfileZone(ProfileZone const &) = delete;
+	ProfileZone &operator=(ProfileZone const &) = delete;
+};
+
+#define PROFILE_ZONE_NAME2(line) profile_zone_ ## line
+#define PROFILE_ZONE_NAME(line) PROFILE_ZONE_NAME2(line)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_NAME(__LINE__)(name)
+
+//label the calling thread in traces:
+void profiler_set_thread_name(std::string const &name);
+
+//write all recorded zones (from all threads) to a Chrome trace-event JSON file:
+// (returns false if the file couldn't be written)
+bool profiler_write_trace(std::string const &filename);
+
+#else //!PROFILER_ENABLED
+
+#define PROFILE_ZONE(name) do { } while (0)
+inline void profiler_set_thread_name(std::string const &) { }
+inline bool profiler_write_trace(std::string const &) { return false; }
+
+#endif
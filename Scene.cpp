@@ -1,11 +1,86 @@
 #include "Scene.hpp"
 
+#include "MatrixBatch.hpp"
 #include "gl_errors.hpp"
-#include "read_write_chunk.hpp"
+#include "ChunkFile.hpp"
+#include "Profiler.hpp"
+#include "FrameStats.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+
+//All instanced draws stream their per-instance data through this buffer:
+// (created by the first call to Scene::bind_instance_attributes)
+static GLuint instance_buffer = 0;
+
+//Matrices for all visible drawables are computed here, in one batch, when building a draw list:
+// (kept between calls to reuse its storage; one per thread, since draw lists may be built on any thread)
+static thread_local MatrixBatch draw_matrices;
+
+namespace {
+	//Frame and Object uniform blocks are streamed through one buffer, used as a ring:
+	// each draw() maps just the range it is about to write, and the buffer is orphaned
+	// whenever the ring wraps, so writes never touch data the GPU may still be reading.
+	struct UniformRing {
+		GLuint buffer = 0;
+		GLsizeiptr size = 0;
+		GLsizeiptr head = 0; //start of unused space
+		GLsizeiptr alignment = 0; //GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+		void init() {
+			if (buffer != 0) return;
+			glGenBuffers(1, &buffer);
+			GLint offset_alignment = 0;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+			alignment = std::max< GLsizeiptr >(offset_alignment, 16);
+		}
+
+		//round up to a legal glBindBufferRange offset:
+		GLsizeiptr align(GLsizeiptr bytes) const {
+			return (bytes + alignment - 1) / alignment * alignment;
+		}
+
+		//map 'bytes' bytes for writing, leaving the buffer bound to GL_UNIFORM_BUFFER;
+		// returns a pointer to the space and stores its offset in the buffer in *offset:
+		void *map(GLsizeiptr bytes, GLintptr *offset) {
+			assert(buffer != 0);
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			GLbitfield access = GL_MAP_WRITE_BIT;
+			if (bytes > size) {
+				//grow:
+				size = std::max(bytes, std::max< GLsizeiptr >(2 * size, 1 << 20));
+				glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+				head = 0;
+				access |= GL_MAP_INVALIDATE_BUFFER_BIT;
+			} else if (head + bytes > size) {
+				//wrap (orphaning the old storage):
+				head = 0;
+				access |= GL_MAP_INVALIDATE_BUFFER_BIT;
+			} else {
+				//space in this storage has never been handed out, so there is no need to synchronize:
+				access |= GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			}
+			void *data = glMapBufferRange(GL_UNIFORM_BUFFER, head, bytes, access);
+			if (!data) throw std::runtime_error("Failed to map uniform buffer.");
+			*offset = head;
+			head += align(bytes);
+			return data;
+		}
+
+		void unmap() {
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+	};
+}
+static UniformRing uniform_ring;
 
 //-------------------------
 
@@ -71,6 +146,14 @@ glm::mat4x3 Scene::Transform::make_world_to_local() const {
 	}
 }
 
+Scene::Drawable::Pipeline &Scene::Drawable::own_pipeline() {
+	if (shared_pipeline) {
+		pipeline = *shared_pipeline;
+		shared_pipeline = nullptr;
+	}
+	return pipeline;
+}
+
 //-------------------------
 
 glm::mat4 Scene::Camera::make_projection() const {
@@ -80,99 +163,586 @@ glm::mat4 Scene::Camera::make_projection() const {
 //-------------------------
 
 
-void Scene::draw(Camera const &camera) const {
+//world-space bounding box of a drawable, or an infinite box if the drawable has no bounds:
+static void world_bounds(Scene::Drawable::Pipeline const &pipeline, glm::mat4x3 const &object_to_world, glm::vec3 *min, glm::vec3 *max) {
+	if (!(pipeline.min.x <= pipeline.max.x && pipeline.min.y <= pipeline.max.y && pipeline.min.z <= pipeline.max.z)) {
+		*min = glm::vec3(-std::numeric_limits< float >::infinity());
+		*max = glm::vec3( std::numeric_limits< float >::infinity());
+		return;
+	}
+	//transform the box's center, and expand its radius by the absolute value of the (linear part of the) matrix:
+	glm::vec3 center = object_to_world * glm::vec4(0.5f * (pipeline.min + pipeline.max), 1.0f);
+	glm::vec3 radius = 0.5f * (pipeline.max - pipeline.min);
+	glm::vec3 world_radius =
+		  glm::abs(object_to_world[0]) * radius.x
+		+ glm::abs(object_to_world[1]) * radius.y
+		+ glm::abs(object_to_world[2]) * radius.z;
+	*min = center - world_radius;
+	*max = center + world_radius;
+}
+
+namespace {
+	//The planes bounding the view volume of a world-to-clip matrix, as (normal, offset) with "inside" positive:
+	struct Frustum {
+		Frustum(glm::mat4 const &world_to_clip) {
+			glm::mat4 m = glm::transpose(world_to_clip); //m[i] is now row i of world_to_clip
+			planes[0] = m[3] + m[0]; //left
+			planes[1] = m[3] - m[0]; //right
+			planes[2] = m[3] + m[1]; //bottom
+			planes[3] = m[3] - m[1]; //top
+			planes[4] = m[3] + m[2]; //near
+			//NOTE: no far plane, since cameras use infinite perspective projections.
+		}
+		//does the box (possibly) overlap the frustum?
+		bool overlaps(glm::vec3 const &min, glm::vec3 const &max) const {
+			if (std::isinf(min.x) || std::isinf(max.x)) return true; //unbounded; never cull
+			glm::vec3 center = 0.5f * (min + max);
+			glm::vec3 radius = 0.5f * (max - min);
+			for (auto const &p : planes) {
+				glm::vec3 n = glm::vec3(p);
+				if (glm::dot(n, center) + p.w < -glm::dot(glm::abs(n), radius)) return false;
+			}
+			return true;
+		}
+		glm::vec4 planes[5];
+	};
+}
+
+void Scene::draw(Camera const &camera, DrawStats *stats, uint32_t layer_mask) const {
+	DrawList list;
+	build_draw_list(camera, &list, layer_mask);
+	submit(list);
+	if (stats) *stats = list.stats;
+}
+
+void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, DrawStats *stats, uint32_t layer_mask) const {
+	DrawList list;
+	build_draw_list(world_to_clip, world_to_light, &list, layer_mask);
+	submit(list);
+	if (stats) *stats = list.stats;
+}
+
+void Scene::build_draw_list(Camera const &camera, DrawList *list, uint32_t layer_mask) const {
 	assert(camera.transform);
 	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
 	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
-	draw(world_to_clip, world_to_light);
+	build_draw_list(world_to_clip, world_to_light, list, layer_mask);
 }
 
-void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+void Scene::build_draw_list(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, DrawList *list_, uint32_t layer_mask) const {
+	PROFILE_ZONE("Scene::build_draw_list");
+	assert(list_);
+	DrawList &list = *list_;
+	list.clear();
+	DrawStats &stats = list.stats;
 
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
-		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+	Frustum frustum(world_to_clip);
+
+	//drawables (with their object-to-world matrices and world-space bounds) that pass culling:
+	struct Visible {
+		Drawable const *drawable;
+		glm::mat4x3 object_to_world;
+		glm::vec3 min, max;
+	};
+	std::vector< Visible > visible;
+
+	//is a drawable shown at all?
+	auto is_shown = [&stats,layer_mask](Drawable const &drawable) {
+		if (drawable.visible && (drawable.layers & layer_mask)) return true;
+		stats.hidden += 1;
+		return false;
+	};
 
+	//is a drawable worth sending to OpenGL at all?
+	auto is_drawable = [](Drawable const &drawable) {
+		Scene::Drawable::Pipeline const &pipeline = drawable.drawn_pipeline();
 		//skip any drawables without a shader program set:
-		if (pipeline.program == 0) continue;
+		if (pipeline.program == 0) return false;
 		//skip any drawables that don't reference any vertex array:
-		if (pipeline.vao == 0) continue;
+		if (pipeline.vao == 0) return false;
 		//skip any drawables that don't contain any vertices:
-		if (pipeline.count == 0) continue;
-
+		if (pipeline.count == 0) return false;
+		return true;
+	};
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+	if (!bvh.empty()) {
+		//walk the hierarchy, skipping whole subtrees that are out of view:
+		std::vector< uint32_t > todo(1, 0);
+		while (!todo.empty()) {
+			BVHNode const &node = bvh[todo.back()];
+			todo.pop_back();
+			if (!frustum.overlaps(node.min, node.max)) {
+				stats.culled += node.end - node.begin;
+				continue;
+			}
+			if (node.left != -1U) {
+				todo.emplace_back(node.left);
+				todo.emplace_back(node.right);
+				continue;
+			}
+			for (uint32_t i = node.begin; i < node.end; ++i) {
+				Drawable const &drawable = *bvh_drawables[i].drawable;
+				if (!is_shown(drawable)) continue;
+				assert(drawable.transform); //drawables *must* have a transform
+				glm::mat4x3 object_to_world = drawable_to_world(drawable, bvh_drawables[i].base_index);
+				glm::vec3 min, max;
+				world_bounds(drawable.drawn_pipeline(), object_to_world, &min, &max);
+				visible.emplace_back(Visible{&drawable, object_to_world, min, max});
+			}
+		}
+	} else {
+		for_each_drawable([&](Drawable const &drawable, uint32_t base_index) {
+			if (!is_shown(drawable)) return;
+			if (!is_drawable(drawable)) return;
+
+			//the object-to-world matrix is used for culling and in all three of the uniforms below:
+			assert(drawable.transform); //drawables *must* have a transform
+			glm::mat4x3 object_to_world = drawable_to_world(drawable, base_index);
+
+			glm::vec3 min, max;
+			world_bounds(drawable.drawn_pipeline(), object_to_world, &min, &max);
+			if (!frustum.overlaps(min, max)) {
+				stats.culled += 1;
+				return;
+			}
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+			visible.emplace_back(Visible{&drawable, object_to_world, min, max});
+		});
+	}
 
-		//Configure program uniforms:
+	//compute matrices for every visible drawable at once (submission only reads the results):
+	MatrixBatch &matrices = draw_matrices;
+	matrices.reset(uint32_t(visible.size()));
+	for (uint32_t i = 0; i < uint32_t(visible.size()); ++i) {
+		matrices.set(i, visible[i].object_to_world);
+	}
+	matrices.compute(world_to_clip, world_to_light);
+
+	//per-frame shader data:
+	FrameBlock &frame = list.frame;
+	frame.WORLD_TO_CLIP = world_to_clip;
+
+	//lights whose range overlaps the view go in the Frame block, sorted by type:
+	struct FrameLight {
+		glm::vec3 position; //world space
+		float radius; //(infinite for lights without a range)
+		float strength; //brightest channel of energy
+		FrameBlock::Light block;
+	};
+	std::vector< FrameLight > frame_lights;
+	for (auto const &light : lights) {
+		if (frame_lights.size() == MaxFrameLights) break;
+		assert(light.transform);
+
+		glm::mat4x3 light_to_world = make_local_to_world(light.transform);
+		FrameLight fl;
+		fl.position = light_to_world[3];
+		fl.radius = std::numeric_limits< float >::infinity();
+		if ((light.type == Light::Point || light.type == Light::Spot) && light.distance > 0.0f) {
+			fl.radius = light.distance;
+			if (!frustum.overlaps(fl.position - glm::vec3(fl.radius), fl.position + glm::vec3(fl.radius))) continue;
+		}
+		fl.strength = std::max(light.energy.r, std::max(light.energy.g, light.energy.b));
+
+		FrameBlock::Light &fb = fl.block;
+		fb.LOCATION = world_to_light * glm::vec4(fl.position, 1.0f);
+		fb.DIRECTION = glm::normalize(world_to_light * glm::vec4(-light_to_world[2], 0.0f));
+		fb.CUTOFF = std::cos(0.5f * light.spot_fov);
+		fb.ENERGY = light.energy;
+		fb.INV_RANGE2 = (std::isinf(fl.radius) ? 0.0f : 1.0f / (fl.radius * fl.radius));
+		switch (light.type) {
+			case Light::Point: fb.TYPE = 0; break;
+			case Light::Hemisphere: fb.TYPE = 1; break;
+			case Light::Spot: fb.TYPE = 2; break;
+			case Light::Directional: fb.TYPE = 3; break;
+		}
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+		frame_lights.emplace_back(fl);
+	}
+	std::stable_sort(frame_lights.begin(), frame_lights.end(), [](FrameLight const &a, FrameLight const &b) {
+		return a.block.TYPE < b.block.TYPE;
+	});
+	frame.LIGHT_TYPE_END = glm::uvec4(0);
+	for (uint32_t l = 0; l < uint32_t(frame_lights.size()); ++l) {
+		frame.LIGHTS[l] = frame_lights[l].block;
+		for (int32_t t = frame_lights[l].block.TYPE; t < 4; ++t) {
+			frame.LIGHT_TYPE_END[t] = l + 1;
+		}
+	}
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+	//each visible drawable gets a list of the lights that reach its bounds:
+	// (if too many do, the ones that seem brightest at the nearest point of the bounds are kept)
+	std::vector< std::array< uint32_t, 2 > > object_lights(visible.size());
+	std::vector< std::pair< float, uint32_t > > reaching; //(estimated brightness, light), for one drawable
+	for (uint32_t i = 0; i < uint32_t(visible.size()); ++i) {
+		reaching.clear();
+		for (uint32_t l = 0; l < uint32_t(frame_lights.size()); ++l) {
+			FrameLight const &fl = frame_lights[l];
+			glm::vec3 closest = glm::clamp(fl.position, visible[i].min, visible[i].max);
+			float dis2 = glm::dot(fl.position - closest, fl.position - closest);
+			if (dis2 > fl.radius * fl.radius) continue;
+			float brightness = (std::isinf(fl.radius) ? fl.strength : fl.strength / std::max(1.0f, dis2));
+			reaching.emplace_back(brightness, l);
+		}
+		if (reaching.size() > MaxObjectLights) {
+			std::partial_sort(reaching.begin(), reaching.begin() + MaxObjectLights, reaching.end(), [](std::pair< float, uint32_t > const &a, std::pair< float, uint32_t > const &b) {
+				return a.first > b.first;
+			});
+			reaching.resize(MaxObjectLights);
+		}
+		//(lists are in index order -- so, also grouped by type)
+		std::sort(reaching.begin(), reaching.end(), [](std::pair< float, uint32_t > const &a, std::pair< float, uint32_t > const &b) {
+			return a.second < b.second;
+		});
+
+		std::array< uint32_t, 2 > &packed = object_lights[i];
+		packed.fill(~0U); //(every entry NoLight)
+		for (uint32_t r = 0; r < uint32_t(reaching.size()); ++r) {
+			uint32_t shift = 8 * (r % 4);
+			packed[r / 4] = (packed[r / 4] & ~(0xffU << shift)) | (reaching[r].second << shift);
 		}
+	}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+	//record a command that draws 'count' drawables starting at visible[*begin]:
+	auto record = [&](uint32_t const *begin, uint32_t count, bool instanced) {
+		list.commands.emplace_back();
+		DrawList::Command &command = list.commands.back();
+		command.pipeline = &visible[*begin].drawable->drawn_pipeline();
+		command.first = uint32_t(list.matrices.size());
+		command.count = count;
+		command.instanced = instanced;
+		for (uint32_t const *i = begin; i != begin + count; ++i) {
+			list.matrices.emplace_back();
+			Instance &instance = list.matrices.back();
+			instance.OBJECT_TO_CLIP = matrices.object_to_clip(*i);
+			instance.OBJECT_TO_LIGHT = matrices.object_to_light(*i);
+			instance.NORMAL_TO_LIGHT = matrices.normal_to_light(*i);
+			instance.LIGHT_LIST[0] = object_lights[*i][0];
+			instance.LIGHT_LIST[1] = object_lights[*i][1];
+			instance.TEXTURE_LAYER = visible[*i].drawable->drawn_pipeline().texture_layer;
+		}
+	};
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+	//drawables that can be instanced are set aside and drawn in groups after the rest:
+	// (list holds indices into visible / matrices)
+	std::vector< uint32_t > instanced;
+	for (uint32_t i = 0; i < uint32_t(visible.size()); ++i) {
+		Scene::Drawable::Pipeline const &pipeline = visible[i].drawable->drawn_pipeline();
+		//defer drawables with an instanced pipeline (and no per-drawable uniforms):
+		if (pipeline.instanced_program != 0 && pipeline.instanced_vao != 0 && !pipeline.set_uniforms) {
+			instanced.emplace_back(i);
+		} else {
+			record(&i, 1, false);
 		}
+	}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+	if (!instanced.empty()) {
+		//sort instanced drawables so that drawables with the same pipeline state end up adjacent:
+		auto key = [&visible](uint32_t i) {
+			Drawable::Pipeline const &p = visible[i].drawable->drawn_pipeline();
+			return std::make_tuple(p.instanced_program, p.instanced_vao, p.type, p.start, p.count, p.index_type,
+				p.textures[0].texture, p.textures[1].texture, p.textures[2].texture, p.textures[3].texture,
+				p.textures[0].target, p.textures[1].target, p.textures[2].target, p.textures[3].target);
+		};
+		std::stable_sort(instanced.begin(), instanced.end(), [&key](uint32_t a, uint32_t b) {
+			return key(a) < key(b);
+		});
+
+		for (auto begin = instanced.begin(); begin != instanced.end(); /* later */) {
+			//find the end of the group of drawables that share a pipeline:
+			auto end = begin + 1;
+			while (end != instanced.end() && key(*end) == key(*begin)) ++end;
+
+			record(&*begin, uint32_t(end - begin), true);
+
+			begin = end;
 		}
+	}
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+	stats.drawn = uint32_t(list.matrices.size());
+}
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+void Scene::DrawList::own_pipelines() {
+	PROFILE_ZONE("Scene::DrawList::own_pipelines");
+	//(each command comes from a different drawable -- or group of instanced drawables -- so gets its own copy)
+	assert(pipelines.empty() && "own_pipelines() is called once per built list");
+	pipelines.reserve(commands.size());
+	for (Command &command : commands) {
+		pipelines.emplace_back(*command.pipeline);
+		command.pipeline = &pipelines.back();
+	}
+}
+
+void Scene::submit(DrawList const &list) {
+	PROFILE_ZONE("Scene::submit");
+	FrameStats::GPUTimer gpu_timer(FrameStats::ScenePass);
+
+	//write the Frame block and every Object block in one pass over mapped memory:
+	uint32_t object_blocks = 0;
+	for (auto const &command : list.commands) {
+		if (!command.instanced && command.pipeline->uses_object_block) object_blocks += 1;
+	}
+
+	uniform_ring.init();
+	GLsizeiptr frame_stride = uniform_ring.align(sizeof(FrameBlock));
+	GLsizeiptr object_stride = uniform_ring.align(sizeof(ObjectBlock));
+	GLintptr frame_offset = 0;
+	{
+		char *data = reinterpret_cast< char * >(uniform_ring.map(frame_stride + object_blocks * object_stride, &frame_offset));
+
+		*reinterpret_cast< FrameBlock * >(data) = list.frame;
+
+		char *object_data = data + frame_stride;
+		for (auto const &command : list.commands) {
+			if (command.instanced || !command.pipeline->uses_object_block) continue;
+			Instance const &matrices = list.matrices[command.first];
+			ObjectBlock &object = *reinterpret_cast< ObjectBlock * >(object_data);
+			object.OBJECT_TO_CLIP = matrices.OBJECT_TO_CLIP;
+			object.OBJECT_TO_LIGHT = glm::mat4(matrices.OBJECT_TO_LIGHT);
+			for (uint32_t c = 0; c < 3; ++c) {
+				object.NORMAL_TO_LIGHT[c] = glm::vec4(matrices.NORMAL_TO_LIGHT[c], 0.0f);
 			}
+			object.LIGHT_LIST[0] = matrices.LIGHT_LIST[0];
+			object.LIGHT_LIST[1] = matrices.LIGHT_LIST[1];
+			object.TEXTURE_LAYER = matrices.TEXTURE_LAYER;
+			object.padding = 0;
+			object_data += object_stride;
 		}
 
-		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		uniform_ring.unmap();
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, FrameBinding, uniform_ring.buffer, frame_offset, sizeof(FrameBlock));
+	GLintptr object_offset = frame_offset + frame_stride;
+
+	//textures stay bound between commands, so consecutive drawables with the same textures don't rebind them:
+	// (only units 0 .. TextureCount-1 are tracked, and everything is unbound at the end)
+	Drawable::Pipeline::TextureInfo bound[Drawable::Pipeline::TextureCount];
+
+	for (auto const &command : list.commands) {
+		//Reference to drawable's pipeline for convenience:
+		Scene::Drawable::Pipeline const &pipeline = *command.pipeline;
+
+		if (command.instanced) {
+			//upload instances (orphaning the previous contents of the buffer):
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			glBufferData(GL_ARRAY_BUFFER, command.count * sizeof(Instance), &list.matrices[command.first], GL_STREAM_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			glUseProgram(pipeline.instanced_program);
+			glBindVertexArray(pipeline.instanced_vao);
+		} else {
+			Instance const &matrices = list.matrices[command.first];
+
+			//Set shader program:
+			glUseProgram(pipeline.program);
+
+			//Set attribute sources:
+			glBindVertexArray(pipeline.vao);
+
+			//Configure program uniforms:
+
+			//matrices already written to the Object block just need to be pointed at:
+			if (pipeline.uses_object_block) {
+				glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBinding, uniform_ring.buffer, object_offset, sizeof(ObjectBlock));
+				object_offset += object_stride;
+			}
+
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(matrices.OBJECT_TO_CLIP));
+			}
+
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(matrices.OBJECT_TO_LIGHT));
+			}
+
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(matrices.NORMAL_TO_LIGHT));
+			}
 
-		//un-bind textures:
+			//set any requested custom uniforms:
+			if (pipeline.set_uniforms) pipeline.set_uniforms();
+		}
+
+		//set up textures (if they aren't already bound):
 		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+			Drawable::Pipeline::TextureInfo const &want = pipeline.textures[i];
+			if (want.texture == 0) continue;
+			if (want.texture == bound[i].texture && want.target == bound[i].target) continue;
+			glActiveTexture(GL_TEXTURE0 + i);
+			if (bound[i].texture != 0 && bound[i].target != want.target) {
+				glBindTexture(bound[i].target, 0); //(a unit holds one texture per target; keep just one bound)
 			}
+			glBindTexture(want.target, want.texture);
+			bound[i] = want;
 		}
-		glActiveTexture(GL_TEXTURE0);
+
+		//draw the object(s):
+		if (pipeline.index_type != 0) {
+			GLsizeiptr index_size = (pipeline.index_type == GL_UNSIGNED_SHORT ? 2 : 4);
+			void const *first = (GLbyte *)0 + pipeline.start * index_size;
+			if (command.instanced) {
+				glDrawElementsInstanced(pipeline.type, pipeline.count, pipeline.index_type, first, GLsizei(command.count));
+			} else {
+				glDrawElements(pipeline.type, pipeline.count, pipeline.index_type, first);
+			}
+		} else {
+			if (command.instanced) {
+				glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, GLsizei(command.count));
+			} else {
+				glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+			}
+		}
+		FrameStats::count_draw(pipeline.type, pipeline.count, GLsizei(command.count));
 
 	}
 
+	//un-bind textures:
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		if (bound[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(bound[i].target, 0);
+		}
+	}
+	glActiveTexture(GL_TEXTURE0);
+
 	glUseProgram(0);
 	glBindVertexArray(0);
 
 	GL_ERRORS();
 }
 
+void Scene::build_bvh() {
+	clear_bvh();
+
+	//gather world-space bounds of every drawable worth drawing:
+	struct Entry {
+		Drawable const *drawable;
+		uint32_t base_index;
+		glm::vec3 min, max;
+		glm::vec3 center; //used for splitting; (0,0,0) for unbounded drawables
+	};
+	std::vector< Entry > entries;
+	for_each_drawable([&](Drawable const &drawable, uint32_t base_index) {
+		Drawable::Pipeline const &pipeline = drawable.drawn_pipeline();
+		if (pipeline.program == 0 || pipeline.vao == 0 || pipeline.count == 0) return;
+		assert(drawable.transform); //drawables *must* have a transform
+		entries.emplace_back();
+		entries.back().drawable = &drawable;
+		entries.back().base_index = base_index;
+		Entry &e = entries.back();
+		world_bounds(pipeline, drawable_to_world(drawable, base_index), &e.min, &e.max);
+		e.center = (std::isinf(e.min.x) ? glm::vec3(0.0f) : 0.5f * (e.min + e.max));
+	});
+	if (entries.empty()) return;
+
+	//build nodes top-down, splitting at the median center along the longest axis:
+	constexpr uint32_t LeafSize = 4;
+	bvh.emplace_back();
+	bvh.back().begin = 0;
+	bvh.back().end = uint32_t(entries.size());
+	for (uint32_t n = 0; n < bvh.size(); ++n) {
+		uint32_t begin = bvh[n].begin;
+		uint32_t end = bvh[n].end;
+
+		glm::vec3 min = entries[begin].min;
+		glm::vec3 max = entries[begin].max;
+		for (uint32_t i = begin + 1; i < end; ++i) {
+			min = glm::min(min, entries[i].min);
+			max = glm::max(max, entries[i].max);
+		}
+		bvh[n].min = min;
+		bvh[n].max = max;
+
+		if (end - begin <= LeafSize) continue;
+
+		//split along the axis where the centers are most spread out:
+		glm::vec3 cmin = entries[begin].center;
+		glm::vec3 cmax = cmin;
+		for (uint32_t i = begin + 1; i < end; ++i) {
+			cmin = glm::min(cmin, entries[i].center);
+			cmax = glm::max(cmax, entries[i].center);
+		}
+		glm::vec3 spread = cmax - cmin;
+		int axis = 0;
+		if (spread.y > spread[axis]) axis = 1;
+		if (spread.z > spread[axis]) axis = 2;
+		if (!(spread[axis] > 0.0f)) continue; //can't usefully split (all centers coincide)
+
+		uint32_t mid = begin + (end - begin) / 2;
+		std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end, [axis](Entry const &a, Entry const &b) {
+			return a.center[axis] < b.center[axis];
+		});
+
+		//n.b. emplace_back may invalidate references into bvh, so index it again:
+		bvh[n].left = uint32_t(bvh.size());
+		bvh.emplace_back();
+		bvh.back().begin = begin;
+		bvh.back().end = mid;
+		bvh[n].right = uint32_t(bvh.size());
+		bvh.emplace_back();
+		bvh.back().begin = mid;
+		bvh.back().end = end;
+	}
+
+	bvh_drawables.reserve(entries.size());
+	for (auto const &e : entries) {
+		bvh_drawables.emplace_back(BVHDrawable{ e.drawable, e.base_index });
+	}
+}
+
+void Scene::clear_bvh() {
+	bvh.clear();
+	bvh_drawables.clear();
+}
+
+void Scene::bind_instance_attributes(GLuint program, std::set< GLuint > *bound) {
+	assert(bound);
+	if (instance_buffer == 0) glGenBuffers(1, &instance_buffer);
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+
+	//matrix attributes take one location per column:
+	auto bind_matrix = [&](char const *name, GLint columns, GLint rows, GLsizei offset) {
+		GLint location = glGetAttribLocation(program, name);
+		if (location == -1) return; //can't bind missing attribs
+		for (GLint c = 0; c < columns; ++c) {
+			GLuint index = GLuint(location + c);
+			glVertexAttribPointer(index, rows, GL_FLOAT, GL_FALSE, sizeof(Instance), (GLbyte *)0 + offset + c * rows * sizeof(float));
+			glVertexAttribDivisor(index, 1); //advance once per instance, not per vertex
+			glEnableVertexAttribArray(index);
+			bound->insert(index);
+		}
+	};
+	bind_matrix("OBJECT_TO_CLIP", 4, 4, offsetof(Instance, OBJECT_TO_CLIP));
+	bind_matrix("OBJECT_TO_LIGHT", 4, 3, offsetof(Instance, OBJECT_TO_LIGHT));
+	bind_matrix("NORMAL_TO_LIGHT", 3, 3, offsetof(Instance, NORMAL_TO_LIGHT));
+
+	//light lists and texture layers are integers, so need glVertexAttribIPointer:
+	auto bind_uint = [&](char const *name, GLint size, GLsizei offset) {
+		GLint location = glGetAttribLocation(program, name);
+		if (location == -1) return; //can't bind missing attribs
+		glVertexAttribIPointer(GLuint(location), size, GL_UNSIGNED_INT, sizeof(Instance), (GLbyte *)0 + offset);
+		glVertexAttribDivisor(GLuint(location), 1);
+		glEnableVertexAttribArray(GLuint(location));
+		bound->insert(GLuint(location));
+	};
+	bind_uint("LIGHT_LIST_LAYER", 3, offsetof(Instance, LIGHT_LIST)); //(LIGHT_LIST, then TEXTURE_LAYER)
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+	PROFILE_ZONE("Scene::load");
 
-	std::ifstream file(filename, std::ios::binary);
+	//(entries are read in place from the mapped file)
+	ChunkFile file(filename);
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	ChunkSpan< char > names = file.read< char >("str0");
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +753,7 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	ChunkSpan< HierarchyEntry > hierarchy = file.read< HierarchyEntry >("xfh0");
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +761,7 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	ChunkSpan< MeshEntry > meshes = file.read< MeshEntry >("msh0");
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +770,7 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > cameras;
-	read_chunk(file, "cam0", &cameras);
+	ChunkSpan< CameraEntry > cameras = file.read< CameraEntry >("cam0");
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,8 +781,7 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > lights;
-	read_chunk(file, "lmp0", &lights);
+	ChunkSpan< LightEntry > lights = file.read< LightEntry >("lmp0");
 
 
 	//--------------------------------
@@ -224,6 +790,8 @@ void Scene::load(std::string const &filename,
 	std::vector< Transform * > hierarchy_transforms;
 	hierarchy_transforms.reserve(hierarchy.size());
 
+	size_t old_drawables = drawables.size(); //(drawables made by on_drawable get indexed, below)
+
 	for (auto const &h : hierarchy) {
 		transforms.emplace_back();
 		Transform *t = &transforms.back();
@@ -245,6 +813,7 @@ void Scene::load(std::string const &filename,
 		t->scale = h.scale;
 
 		hierarchy_transforms.emplace_back(t);
+		index(t);
 	}
 	assert(hierarchy_transforms.size() == hierarchy.size());
 
@@ -263,6 +832,11 @@ void Scene::load(std::string const &filename,
 
 	}
 
+	//index any drawables made by on_drawable:
+	for (auto d = std::next(drawables.begin(), old_drawables); d != drawables.end(); ++d) {
+		index(&*d);
+	}
+
 	for (auto const &c : cameras) {
 		if (c.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains camera entry with invalid transform index (" + std::to_string(c.transform) + ")");
@@ -299,12 +873,13 @@ void Scene::load(std::string const &filename,
 		light->type = static_cast<Light::Type>(l.type);
 		light->energy = glm::vec3(l.color) / 255.0f * l.energy;
 		light->spot_fov = l.fov / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
+		light->distance = l.distance;
 	}
 
 	//load any extra that a subclass wants:
 	load_extra(file, names, hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (!file.at_end()) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -363,6 +938,29 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 		d.transform = transform_to_transform.at(d.transform);
 	}
 
+	//share other's base scene (if any), updating override pointers:
+	base = other.base;
+	transform_overrides.clear();
+	for (auto const &to : other.transform_overrides) {
+		transform_overrides.emplace(to.first, transform_to_transform.at(to.second));
+	}
+	drawable_overrides.clear();
+	if (!other.drawable_overrides.empty()) {
+		std::unordered_map< Drawable const *, Drawable * > drawable_to_drawable;
+		auto di = drawables.begin();
+		for (auto const &d : other.drawables) {
+			drawable_to_drawable.emplace(&d, &*di);
+			++di;
+		}
+		for (auto const &dov : other.drawable_overrides) {
+			drawable_overrides.emplace(dov.first, drawable_to_drawable.at(dov.second));
+		}
+	}
+	base_drawables = other.base_drawables;
+	for (auto &bd : base_drawables) {
+		if (bd.ancestor_override) bd.ancestor_override = transform_to_transform.at(bd.ancestor_override);
+	}
+
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
 	for (auto &c : cameras) {
@@ -374,4 +972,242 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	for (auto &l : lights) {
 		l.transform = transform_to_transform.at(l.transform);
 	}
+
+	//rebuild the name index, since it points at this scene's objects:
+	transform_names.clear();
+	sorted_transform_names.clear();
+	transform_drawables.clear();
+	for (auto &t : transforms) {
+		index(&t);
+	}
+	for (auto &d : drawables) {
+		index(&d);
+	}
+
+	//other's bounding volume hierarchy refers to other's drawables, so don't copy it:
+	clear_bvh();
+}
+
+//-------------------------
+
+void Scene::instantiate(std::shared_ptr< Scene const > const &base_) {
+	if (base_ && base_->base) throw std::runtime_error("Cannot instantiate a scene that is itself an instance of another scene.");
+
+	transforms.clear();
+	drawables.clear();
+	cameras.clear();
+	lights.clear();
+	transform_overrides.clear();
+	drawable_overrides.clear();
+	base_drawables.clear();
+	transform_names.clear();
+	sorted_transform_names.clear();
+	transform_drawables.clear();
+	clear_bvh();
+
+	base = base_;
+	if (!base) return;
+
+	//cameras and lights are copied (with their transforms), since they are few and often modified:
+	for (auto const &c : base->cameras) {
+		cameras.emplace_back(c);
+		cameras.back().transform = modify(c.transform);
+	}
+	for (auto const &l : base->lights) {
+		lights.emplace_back(l);
+		lights.back().transform = modify(l.transform);
+	}
+}
+
+Scene::Transform *Scene::modify(Transform const *transform) {
+	assert(transform);
+	//transforms of a non-instanced scene are all its own:
+	if (!base) return const_cast< Transform * >(transform);
+
+	auto f = transform_overrides.find(transform);
+	if (f != transform_overrides.end()) return f->second;
+
+	//copy ancestors first, so overrides only ever point at other overrides:
+	Transform *parent = (transform->parent ? modify(transform->parent) : nullptr);
+
+	transforms.emplace_back();
+	Transform &t = transforms.back();
+	t.name = transform->name;
+	t.position = transform->position;
+	t.rotation = transform->rotation;
+	t.scale = transform->scale;
+	t.parent = parent;
+
+	transform_overrides.emplace(transform, &t);
+	index(&t);
+
+	//base drawables below this transform are now positioned by the override:
+	anchor_base_drawables(transform, &t);
+
+	return &t;
+}
+
+Scene::Drawable *Scene::modify(Drawable const *drawable) {
+	assert(drawable);
+	if (!base) return const_cast< Drawable * >(drawable);
+
+	auto f = drawable_overrides.find(drawable);
+	if (f != drawable_overrides.end()) return f->second;
+
+	//(copies everything but the pipeline, which is shared -- pipelines can be large, e.g. with set_uniforms functions)
+	drawables.emplace_back(modify(drawable->transform));
+	Drawable &d = drawables.back();
+	d.visible = drawable->visible;
+	d.layers = drawable->layers;
+	d.shared_pipeline = &drawable->drawn_pipeline();
+
+	drawable_overrides.emplace(drawable, &d);
+	index(&d);
+	if (base_drawables.empty()) base_drawables.resize(base->drawables.size());
+	base_drawables[base->hierarchy().drawable_index.at(drawable)].overridden = true;
+	return &d;
+}
+
+Scene::Transform const *Scene::resolve(Transform const *transform) const {
+	if (transform_overrides.empty()) return transform;
+	auto f = transform_overrides.find(transform);
+	if (f != transform_overrides.end()) return f->second;
+	return transform;
+}
+
+glm::mat4x3 Scene::make_local_to_world(Transform const *transform) const {
+	assert(transform);
+	if (transform_overrides.empty()) return transform->make_local_to_world();
+
+	//overrides' ancestors are all overrides, so resolving can stop at the first overridden ancestor:
+	glm::mat4 below(1.0f);
+	for (Transform const *t = transform; t != nullptr; t = t->parent) {
+		Transform const *r = resolve(t);
+		if (r != t) return r->make_local_to_world() * below;
+		below = glm::mat4(t->make_local_to_parent()) * below;
+	}
+	return glm::mat4x3(below);
+}
+
+glm::mat4x3 Scene::drawable_to_world(Drawable const &drawable, uint32_t base_index) const {
+	assert(drawable.transform);
+	if (base_index == -1U || base_drawables.empty()) return drawable.transform->make_local_to_world();
+	BaseDrawable const &bd = base_drawables[base_index];
+	if (!bd.ancestor_override) return drawable.transform->make_local_to_world();
+
+	//base transforms below the overridden ancestor, then the ancestor's override:
+	glm::mat4 below(1.0f);
+	for (Transform const *t = drawable.transform; t != bd.overridden_ancestor; t = t->parent) {
+		assert(t);
+		below = glm::mat4(t->make_local_to_parent()) * below;
+	}
+	return bd.ancestor_override->make_local_to_world() * below;
+}
+
+Scene::Hierarchy const &Scene::hierarchy() const {
+	std::call_once(hierarchy_once, [this]() {
+		hierarchy_data.reset(new Hierarchy);
+		for (auto const &t : transforms) {
+			hierarchy_data->children[t.parent].emplace_back(&t);
+		}
+		uint32_t i = 0;
+		for (auto const &d : drawables) {
+			hierarchy_data->drawables[d.transform].emplace_back(i);
+			hierarchy_data->drawable_index.emplace(&d, i);
+			++i;
+		}
+	});
+	return *hierarchy_data;
+}
+
+void Scene::anchor_base_drawables(Transform const *transform, Transform const *anchor) {
+	assert(base);
+	Hierarchy const &h = base->hierarchy();
+	if (base_drawables.empty()) base_drawables.resize(base->drawables.size());
+
+	std::vector< Transform const * > todo(1, transform);
+	while (!todo.empty()) {
+		Transform const *t = todo.back();
+		todo.pop_back();
+		//(a nearer overridden ancestor positions everything below it)
+		if (t != transform && transform_overrides.count(t)) continue;
+		auto d = h.drawables.find(t);
+		if (d != h.drawables.end()) {
+			for (uint32_t i : d->second) {
+				base_drawables[i].overridden_ancestor = transform;
+				base_drawables[i].ancestor_override = anchor;
+			}
+		}
+		auto c = h.children.find(t);
+		if (c != h.children.end()) todo.insert(todo.end(), c->second.begin(), c->second.end());
+	}
+}
+
+//-------------------------
+
+void Scene::index(Transform *transform) {
+	assert(transform);
+	transform_names.insert(transform->name, transform); //(keeps the first transform with each name)
+	sorted_transform_names.emplace(transform->name, transform);
+}
+
+void Scene::index(Drawable *drawable) {
+	assert(drawable);
+	transform_drawables.emplace(drawable->transform, drawable); //(keeps the first drawable on each transform)
+}
+
+Scene::Transform const *Scene::find_transform(HashedName const &name) const {
+	if (Transform * const *t = transform_names.find(name)) return *t;
+	if (base) return resolve(base->find_transform(name));
+	return nullptr;
+}
+
+Scene::Transform *Scene::find_transform(HashedName const &name) {
+	if (Transform * const *t = transform_names.find(name)) return *t;
+	if (base) {
+		Transform const *t = base->find_transform(name);
+		if (t) return modify(t);
+	}
+	return nullptr;
+}
+
+std::vector< Scene::Transform const * > Scene::find_all(std::string const &prefix) const {
+	std::vector< Transform const * > ret;
+
+	//transforms with names in [prefix, end) of a sorted index:
+	auto gather = [&prefix](std::multimap< std::string, Transform * > const &sorted, std::function< void(Transform const *) > const &fn) {
+		for (auto f = sorted.lower_bound(prefix); f != sorted.end(); ++f) {
+			if (f->first.compare(0, prefix.size(), prefix) != 0) break;
+			fn(f->second);
+		}
+	};
+
+	gather(sorted_transform_names, [&ret](Transform const *t) {
+		ret.emplace_back(t);
+	});
+	if (base) {
+		//base transforms with overrides were already found (as their overrides), above:
+		gather(base->sorted_transform_names, [this, &ret](Transform const *t) {
+			if (!transform_overrides.count(t)) ret.emplace_back(t);
+		});
+		std::stable_sort(ret.begin(), ret.end(), [](Transform const *a, Transform const *b) {
+			return a->name < b->name;
+		});
+	}
+
+	return ret;
+}
+
+Scene::Drawable const *Scene::find_drawable(Transform const *transform) const {
+	auto f = transform_drawables.find(resolve(transform));
+	if (f != transform_drawables.end()) return f->second;
+	if (base) {
+		Drawable const *drawable = base->find_drawable(transform);
+		if (drawable) {
+			auto o = drawable_overrides.find(drawable);
+			if (o != drawable_overrides.end()) return o->second;
+		}
+		return drawable;
+	}
+	return nullptr;
 }
@@ -11,18 +11,33 @@
  */
 
 #include "GL.hpp"
+#include "ChunkFile.hpp"
+#include "HashedName.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <cstddef>
+#include <limits>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <functional>
 #include <string>
 #include <vector>
+#include <set>
+#include <type_traits>
 #include <unordered_map>
 
 struct Scene {
+	//Drawables may be placed on any of 32 layers (bits of Drawable::layers);
+	// draw() takes a mask of layers to draw:
+	enum : uint32_t {
+		DefaultLayer = 1U,
+		AllLayers = ~0U
+	};
+
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
 		std::string name;
@@ -54,6 +69,11 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//draw() skips drawables that aren't visible or aren't on any of the layers it is asked to draw,
+		// before doing any matrix math or OpenGL calls:
+		bool visible = true;
+		uint32_t layers = DefaultLayer; //bitmask
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -65,12 +85,34 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//if set (to GL_UNSIGNED_SHORT or GL_UNSIGNED_INT), draw with glDrawElements instead:
+			// start and count are then a range of indices in the element buffer bound in vao (see Mesh::index_type)
+			GLenum index_type = 0;
+
+			//bounding box of the vertices (in object space); used to skip drawables that are out of view:
+			// (the default, empty, box means "never cull")
+			glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+			glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
 			//uniforms:
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
+			//if set, the program reads the three matrices above from the "Object" uniform block (see Scene::ObjectBlock),
+			// and draw() binds this drawable's slice of the per-object uniform buffer instead of setting uniforms:
+			bool uses_object_block = false;
+
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
+			// (it shouldn't change texture bindings -- submit() keeps track of them to avoid rebinding)
+
+			//(optional) instanced version of the above program + attribute mapping:
+			// drawables that share instanced_program, instanced_vao, type, start, count, index_type, and textures
+			// (and have no set_uniforms function) are drawn together with one glDrawArraysInstanced call.
+			// (texture_layer may differ, so drawables using different layers of one array texture still draw together)
+			// instanced_vao should read per-instance matrices via Scene::bind_instance_attributes.
+			GLuint instanced_program = 0;
+			GLuint instanced_vao = 0;
 
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
@@ -78,7 +120,20 @@ struct Scene {
 				GLuint texture = 0;
 				GLenum target = GL_TEXTURE_2D;
 			} textures[TextureCount];
+
+			//layer of textures[0] to draw with, when it is an array texture (see TextureArray.hpp):
+			// (sent to the program as TEXTURE_LAYER, in the "Object" block or as a per-instance attribute)
+			uint32_t texture_layer = 0;
 		} pipeline;
+
+		//overrides (see Scene::modify) draw with their base drawable's pipeline rather than a copy of it:
+		// (own_pipeline() copies it into 'pipeline', for overrides that need to change it)
+		Pipeline const *shared_pipeline = nullptr;
+
+		//the pipeline draw() uses:
+		Pipeline const &drawn_pipeline() const { return shared_pipeline ? *shared_pipeline : pipeline; }
+		//make 'pipeline' the one that is drawn (copying the shared pipeline, if there is one), and return it:
+		Pipeline &own_pipeline();
 	};
 
 	struct Camera {
@@ -114,6 +169,9 @@ struct Scene {
 
 		//Spotlight specific:
 		float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
+
+		//Point and spot light specific:
+		float distance = 0.0f; //light has no effect beyond this distance (0 means no limit)
 	};
 
 	//Scenes, of course, may have many of the above objects:
@@ -122,11 +180,140 @@ struct Scene {
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Counts of what happened during a call to draw():
+	struct DrawStats {
+		uint32_t drawn = 0; //drawables sent to OpenGL
+		uint32_t culled = 0; //drawables skipped because their bounds were outside the view frustum
+		uint32_t hidden = 0; //drawables skipped because they were not visible or not on a requested layer
+	};
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
-	void draw(Camera const &camera) const;
+	// (drawables with bounds entirely outside the camera's view are skipped)
+	// (each drawable is lit by -- at most MaxObjectLights of -- the scene's lights that can reach its bounds)
+	// (this is just build_draw_list() followed by submit(); see below)
+	void draw(Camera const &camera, DrawStats *stats = nullptr, uint32_t layer_mask = AllLayers) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
-	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f), DrawStats *stats = nullptr, uint32_t layer_mask = AllLayers) const;
+
+	//Large, mostly-static scenes can cull using a bounding volume hierarchy:
+	// build_bvh() records the current world-space bounds of every drawable;
+	// while the hierarchy exists, draw() considers *only* those drawables (at those bounds),
+	// so call build_bvh() again (or clear_bvh()) after moving, adding, or removing drawables.
+	void build_bvh();
+	void clear_bvh();
+
+	struct BVHNode {
+		glm::vec3 min, max; //world-space bounds of everything below this node
+		uint32_t begin, end; //range of bvh_drawables below this node
+		uint32_t left = -1U, right = -1U; //child nodes (-1U for leaves)
+	};
+	std::vector< BVHNode > bvh; //bvh[0] is the root (if it exists)
+	struct BVHDrawable {
+		Drawable const *drawable;
+		uint32_t base_index; //(see for_each_drawable)
+	};
+	std::vector< BVHDrawable > bvh_drawables;
+
+	//Per-instance data used when drawing instanced pipelines:
+	// (stored, in this layout, in a stream buffer shared by all instanced draws)
+	struct Instance {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::mat4x3 OBJECT_TO_LIGHT;
+		glm::mat3 NORMAL_TO_LIGHT;
+		uint32_t LIGHT_LIST[2]; //(see below)
+		uint32_t TEXTURE_LAYER; //(Drawable::Pipeline::texture_layer)
+	};
+	static_assert(sizeof(Instance) == 4*16 + 4*12 + 4*9 + 4*2 + 4, "Instance is packed.");
+	static_assert(offsetof(Instance, TEXTURE_LAYER) == offsetof(Instance, LIGHT_LIST) + 4*2, "LIGHT_LIST and TEXTURE_LAYER can be read as one uvec3.");
+
+	//point the per-instance attributes "OBJECT_TO_CLIP", "OBJECT_TO_LIGHT", "NORMAL_TO_LIGHT", and "LIGHT_LIST_LAYER"
+	// (a uvec3 of LIGHT_LIST followed by TEXTURE_LAYER -- one attribute, since GL only guarantees 16 locations)
+	// of 'program' (in the currently bound vertex array object) at the shared instance buffer:
+	// (pass as the 'bind_extra' argument of MeshBuffer::make_vao_for_program to build an instanced_vao)
+	static void bind_instance_attributes(GLuint program, std::set< GLuint > *bound);
+
+	//Shader data written by draw() into a streamed uniform buffer, once per call:
+	// programs connect their blocks to these binding points with gl_bind_uniform_block()
+	enum : GLuint {
+		FrameBinding = 0, //"Frame" block, shared by every drawable
+		ObjectBinding = 1, //"Object" block, one per drawable with pipeline.uses_object_block
+	};
+
+	//Lights that may affect something in view are sent in the Frame block (the first MaxFrameLights of them),
+	// and each drawable gets a list of the (at most MaxObjectLights) Frame block lights that reach its bounds.
+	//A light list packs four 8-bit indices (in increasing order) into each of two words, lowest byte first; unused entries are NoLight.
+	// (so shaders loop over just the lights that affect the drawable)
+	enum : uint32_t {
+		MaxFrameLights = 32,
+		MaxObjectLights = 8,
+		NoLight = 0xff,
+	};
+
+	//"Frame" block contents, in std140 layout:
+	// (light locations and directions are in light space, i.e., the 'world_to_light' space passed to draw())
+	// (lights are sorted by type, so shaders can handle each type in its own loop, without branching on type)
+	struct FrameBlock {
+		glm::mat4 WORLD_TO_CLIP;
+		glm::uvec4 LIGHT_TYPE_END; //LIGHT_TYPE_END[t] is one past the index of the last light with TYPE <= t
+		struct Light {
+			glm::vec3 LOCATION; int32_t TYPE; //0: point, 1: hemisphere, 2: spot, 3: directional
+			glm::vec3 DIRECTION; float CUTOFF; //cutoff is the cosine of the spot light's half-angle
+			glm::vec3 ENERGY; float INV_RANGE2; //1 / Light::distance^2 (0 for lights with unlimited range)
+		} LIGHTS[MaxFrameLights];
+	};
+	static_assert(sizeof(FrameBlock) == 4*16 + 16 + MaxFrameLights*3*16, "FrameBlock matches std140 layout.");
+
+	//"Object" block contents, in std140 layout:
+	// (std140 pads mat4x3 and mat3 columns to four floats)
+	struct ObjectBlock {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::mat4 OBJECT_TO_LIGHT; //mat4x3 in the shader
+		glm::vec4 NORMAL_TO_LIGHT[3]; //mat3 in the shader
+		uint32_t LIGHT_LIST[2]; //uvec2 in the shader
+		uint32_t TEXTURE_LAYER; //uint in the shader
+		uint32_t padding;
+	};
+	static_assert(sizeof(ObjectBlock) == 4*16 + 4*16 + 3*16 + 16, "ObjectBlock matches std140 layout.");
+
+	//A DrawList records everything draw() sends to OpenGL, but is built without making any OpenGL calls:
+	// - build_draw_list() does culling, matrix math, and instance grouping; it may run on any thread.
+	// - submit() sends a list to OpenGL; it must run on the thread with the OpenGL context.
+	//A list may be submitted any number of times (e.g., on frames where nothing in the scene or camera moved),
+	// as long as the drawables it was built from still exist (commands point at their pipelines),
+	// or -- after own_pipelines() -- at any time, even while the scene is changed on another thread.
+	struct DrawList {
+		struct Command {
+			Drawable::Pipeline const *pipeline; //pipeline to draw with
+			uint32_t first; //first entry in 'matrices' used by this command
+			uint32_t count; //number of entries (== number of drawables; 1 unless instanced)
+			bool instanced; //draw using pipeline's instanced_program and instanced_vao
+		};
+		static_assert(std::is_trivially_copyable< Command >::value, "Commands are plain old data.");
+
+		FrameBlock frame;
+		std::vector< Command > commands;
+		std::vector< Instance > matrices;
+		DrawStats stats;
+
+		//copies of the pipelines commands use, made by own_pipelines():
+		std::vector< Drawable::Pipeline > pipelines;
+
+		//copy every pipeline the commands point at into 'pipelines' (and point the commands there instead):
+		// (NOTE: pipelines' set_uniforms functions are copied too, so must be safe to call after the scene changes)
+		void own_pipelines();
+
+		void clear() {
+			commands.clear();
+			matrices.clear();
+			stats = DrawStats();
+			pipelines.clear();
+		}
+	};
+
+	void build_draw_list(Camera const &camera, DrawList *list, uint32_t layer_mask = AllLayers) const;
+	void build_draw_list(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, DrawList *list, uint32_t layer_mask = AllLayers) const;
+	static void submit(DrawList const &list);
 
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
@@ -137,7 +324,8 @@ struct Scene {
 
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
-	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
+	// (read chunks with from.read< T >(magic), as in load())
+	virtual void load_extra(ChunkFile &from, ChunkSpan< char > const &str0, std::vector< Transform * > const &xfh0) { }
 
 	//empty scene:
 	Scene() = default;
@@ -150,4 +338,99 @@ struct Scene {
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//----- name index -----
+	//Transforms are indexed by name (and drawables by their transform) as they are loaded, copied, or modified,
+	// so that finding them doesn't mean scanning the whole scene:
+	// (if your code adds transforms or drawables to the lists directly, pass them to index() to make them findable)
+	void index(Transform *transform);
+	void index(Drawable *drawable);
+
+	//the first transform with a given name, or nullptr if there is none:
+	// (in an instance, the base scene is searched as well; the non-const version returns a writable override, via modify())
+	Transform const *find_transform(HashedName const &name) const;
+	Transform *find_transform(HashedName const &name);
+
+	//all transforms whose names start with 'prefix', in name order:
+	std::vector< Transform const * > find_all(std::string const &prefix) const;
+
+	//the first drawable attached to a transform, or nullptr if there is none:
+	Drawable const *find_drawable(Transform const *transform) const;
+
+	FlatNameMap< Transform * > transform_names; //name -> first transform with that name
+	std::multimap< std::string, Transform * > sorted_transform_names; //name -> transforms, for prefix queries
+	std::unordered_map< Transform const *, Drawable * > transform_drawables; //transform -> first drawable attached to it
+
+	//----- copy-on-write instances -----
+	//Copying a scene (above) copies every transform and drawable.
+	//Instead, a scene can be an *instance* of a shared, immutable base scene:
+	// the base's transforms and drawables are drawn as if they were part of this scene, but are not copied;
+	// only objects passed to modify() get private, writable copies ("overrides"), so instantiating costs
+	// O(objects modified) rather than O(objects in scene).
+	//Cameras and lights (and their transforms) are copied, since they are few and usually modified.
+	//NOTE: to attach a new transform or drawable to a base transform, use modify(base transform) as its parent.
+
+	//make this scene an (otherwise empty) instance of 'base':
+	// (base may not itself be an instance; passing nullptr just clears the scene)
+	void instantiate(std::shared_ptr< Scene const > const &base);
+
+	//get a writable version of a transform or drawable in base (copying it -- and, for transforms, its ancestors -- on first use):
+	// (in a scene with no base, these just return their argument)
+	// (drawable overrides share the base drawable's pipeline; call own_pipeline() on one to change its pipeline)
+	Transform *modify(Transform const *transform);
+	Drawable *modify(Drawable const *drawable);
+
+	//the version of a transform that is actually drawn (its override, if it has one):
+	Transform const *resolve(Transform const *transform) const;
+
+	//like transform->make_local_to_world(), but using overrides for the transform and its ancestors:
+	glm::mat4x3 make_local_to_world(Transform const *transform) const;
+
+	std::shared_ptr< Scene const > base;
+	std::unordered_map< Transform const *, Transform * > transform_overrides; //base transform -> override
+	std::unordered_map< Drawable const *, Drawable * > drawable_overrides; //base drawable -> override
+
+	//How each base drawable is drawn, worked out when overrides are made (so draw() doesn't look anything up):
+	// (one entry per base drawable, in base->drawables order; empty until something is overridden)
+	struct BaseDrawable {
+		bool overridden = false; //drawn as its override instead
+		//if an ancestor has an override, the nearest such ancestor (in base) and its override:
+		// (the drawable's world matrix is then the override's, times the base transforms below 'overridden_ancestor')
+		Transform const *overridden_ancestor = nullptr;
+		Transform const *ancestor_override = nullptr;
+	};
+	std::vector< BaseDrawable > base_drawables;
+
+	//call fn(Drawable const &, uint32_t base_index) for every drawable draw() considers:
+	// (un-overridden base drawables, with their index in base->drawables, followed by this scene's drawables, with base_index -1U)
+	template< typename F >
+	void for_each_drawable(F const &fn) const {
+		if (base) {
+			uint32_t base_index = 0;
+			for (auto const &drawable : base->drawables) {
+				if (base_drawables.empty() || !base_drawables[base_index].overridden) fn(drawable, base_index);
+				++base_index;
+			}
+		}
+		for (auto const &drawable : drawables) {
+			fn(drawable, -1U);
+		}
+	}
+
+	//world matrix of a drawable passed to for_each_drawable's fn:
+	glm::mat4x3 drawable_to_world(Drawable const &drawable, uint32_t base_index) const;
+
+	//A base scene's hierarchy, for instances to find what is below a transform they override:
+	// (built by the first call to hierarchy(), so the base scene shouldn't change after it is instantiated)
+	struct Hierarchy {
+		std::unordered_map< Transform const *, std::vector< Transform const * > > children;
+		std::unordered_map< Transform const *, std::vector< uint32_t > > drawables; //(indices in 'drawables')
+		std::unordered_map< Drawable const *, uint32_t > drawable_index;
+	};
+	Hierarchy const &hierarchy() const;
+	mutable std::once_flag hierarchy_once;
+	mutable std::unique_ptr< Hierarchy > hierarchy_data;
+
+	//(used by modify) base drawables below base transform 'transform' (down to any nearer overridden transform) are now positioned by its override, 'anchor':
+	void anchor_base_drawables(Transform const *transform, Transform const *anchor);
 };
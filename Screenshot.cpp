@@ -0,0 +1,353 @@
+#include "Screenshot.hpp"
+
+#include "load_save_png.hpp"
+#include "Profiler.hpp"
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+	//pixels being read into a pixel buffer object:
+	struct Readback {
+		GLuint buffer = 0;
+		GLsizeiptr buffer_size = 0; //(bytes allocated for 'buffer'; it only grows)
+		GLsync fence = 0; //signalled when the pixels have arrived (0 if this readback isn't in use)
+		uint64_t order = 0; //(readbacks are finished in the order they were started)
+		glm::uvec2 size = glm::uvec2(0);
+		std::string filename; //(for captured frames, the prefix -- the frame number is added once the frame is kept)
+		bool numbered = false; //is this a captured frame?
+		bool droppable = false; //may be dropped if the encoders are behind
+		PNGSaveOptions png;
+	};
+
+	//pixels copied out of a pixel buffer object, to be saved by an encoding thread:
+	struct Image {
+		std::string filename;
+		glm::uvec2 size;
+		std::vector< glm::u8vec4 > pixels; //(rows bottom-to-top, as read from OpenGL)
+		PNGSaveOptions png;
+	};
+
+	bool ends_with(std::string const &str, std::string const &suffix) {
+		return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	//binary PPM: no compression at all, so it is as fast to write as the disk allows:
+	void save_ppm(std::string const &filename, glm::uvec2 const &size, glm::u8vec4 const *data) {
+		std::ofstream file(filename, std::ios::binary);
+		file << "P6\n" << size.x << " " << size.y << "\n255\n";
+		std::vector< char > row(size_t(size.x) * 3);
+		for (uint32_t y = size.y; y > 0; --y) { //(PPM rows are top-to-bottom)
+			glm::u8vec4 const *px = data + size_t(y - 1) * size.x;
+			for (uint32_t x = 0; x < size.x; ++x) {
+				row[3*x+0] = char(px[x].r);
+				row[3*x+1] = char(px[x].g);
+				row[3*x+2] = char(px[x].b);
+			}
+			file.write(row.data(), row.size());
+		}
+		if (!file) {
+			std::cerr << "Failed to write '" << filename << "'." << std::endl;
+		}
+	}
+
+	struct Screenshots {
+		//images waiting on the GPU:
+		// (a few, so screenshots in quick succession -- or captured frames -- don't have to wait)
+		std::array< Readback, 3 > readbacks;
+		uint64_t started = 0;
+
+		//continuous capture state:
+		bool capturing = false;
+		Screenshot::CaptureSettings capture_settings;
+		uint64_t capture_frames = 0; //frames seen since capture started
+		uint64_t captured = 0; //frames captured since capture started (numbered as they are passed to the encoders, so dropped frames leave no gaps)
+
+		//everything below is guarded by 'mutex':
+		std::mutex mutex;
+		std::condition_variable work_cv; //signalled when 'images' gets an image, an image is written, or stopping is set
+		std::condition_variable room_cv; //signalled when an image is taken from 'images'
+		std::deque< Image > images;
+		std::set< std::string > writing; //filenames being written right now (so two images never write the same file at once)
+		uint64_t dropped = 0; //captured frames dropped since capture started
+		bool stopping = false;
+
+		std::vector< std::thread > encoders; //(started when there is something to encode; stopped by finish())
+		//at most this many images wait for an encoder (each one is a whole window's worth of pixels):
+		size_t max_images = 1;
+
+		void encode() {
+			profiler_set_thread_name("image encoder");
+			std::unique_lock< std::mutex > lock(mutex);
+			auto next = [this]() {
+				return std::find_if(images.begin(), images.end(), [this](Image const &image) {
+					return writing.count(image.filename) == 0;
+				});
+			};
+			while (true) {
+				work_cv.wait(lock, [&](){ return (stopping && images.empty()) || next() != images.end(); });
+				auto found = next();
+				if (found == images.end()) return; //(only stop once everything has been written)
+				Image image = std::move(*found);
+				images.erase(found);
+				writing.insert(image.filename);
+				room_cv.notify_all();
+				//share the cores between the images being written right now:
+				if (image.png.threads == 0) {
+					image.png.threads = std::max(1U, std::thread::hardware_concurrency() / uint32_t(writing.size()));
+				}
+
+				lock.unlock();
+				if (ends_with(image.filename, ".ppm")) {
+					PROFILE_ZONE("encode ppm");
+					save_ppm(image.filename, image.size, image.pixels.data());
+				} else {
+					PROFILE_ZONE("encode png");
+					//the window's alpha channel isn't meaningful, so make it opaque:
+					for (auto &px : image.pixels) {
+						px.a = 0xff;
+					}
+					//(save_png flips the rows as it writes)
+					try {
+						save_png(image.filename, image.size, image.pixels.data(), LowerLeftOrigin, image.png);
+					} catch (std::exception &e) {
+						std::cerr << e.what() << std::endl;
+					}
+				}
+				lock.lock();
+
+				writing.erase(image.filename);
+				work_cv.notify_all();
+			}
+		}
+
+		//(call with 'mutex' held)
+		void start_encoders() {
+			if (!encoders.empty()) return;
+			//leave a core for the main thread:
+			uint32_t cores = std::thread::hardware_concurrency();
+			uint32_t count = std::min(8U, (cores > 1 ? cores - 1 : 1U));
+			max_images = count;
+			for (uint32_t i = 0; i < count; ++i) {
+				encoders.emplace_back(&Screenshots::encode, this);
+			}
+		}
+	};
+
+	Screenshots &get_screenshots() {
+		static Screenshots screenshots;
+		return screenshots;
+	}
+
+	//the readback in use that was started first (or nullptr if none are in use):
+	Readback *oldest_readback(Screenshots &screenshots) {
+		Readback *oldest = nullptr;
+		for (Readback &r : screenshots.readbacks) {
+			if (r.fence && (!oldest || r.order < oldest->order)) oldest = &r;
+		}
+		return oldest;
+	}
+
+	//wait for a readback's pixels, copy them out, and queue them for encoding:
+	// (captured frames are numbered here, using the current capture settings)
+	void finish_readback(Screenshots &screenshots, Readback &readback) {
+		PROFILE_ZONE("Screenshot::finish_readback");
+		assert(readback.fence);
+		glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(10) * 1000000000);
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+
+		//drop (before spending any time copying) if the encoders are behind:
+		if (readback.droppable) {
+			std::unique_lock< std::mutex > lock(screenshots.mutex);
+			if (!screenshots.encoders.empty() && screenshots.images.size() >= screenshots.max_images) {
+				screenshots.dropped += 1;
+				return;
+			}
+		}
+
+		Image image;
+		image.filename = readback.filename;
+		image.size = readback.size;
+		image.png = readback.png;
+		image.pixels.resize(size_t(image.size.x) * image.size.y);
+		GLsizeiptr bytes = GLsizeiptr(image.pixels.size() * sizeof(glm::u8vec4));
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		void const *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+		if (mapped) {
+			std::memcpy(image.pixels.data(), mapped, size_t(bytes));
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		GL_ERRORS();
+
+		if (!mapped) {
+			std::cerr << "Failed to read back pixels for '" << image.filename << "'." << std::endl;
+			return;
+		}
+
+		//captured frames get their number only once they are sure to be written:
+		if (readback.numbered) {
+			std::ostringstream filename;
+			filename << image.filename << '-' << std::setw(6) << std::setfill('0') << screenshots.captured << (screenshots.capture_settings.ppm ? ".ppm" : ".png");
+			image.filename = filename.str();
+			screenshots.captured += 1;
+		}
+
+		{
+			std::unique_lock< std::mutex > lock(screenshots.mutex);
+			screenshots.start_encoders();
+			//otherwise, wait for the encoders to make room:
+			if (screenshots.images.size() >= screenshots.max_images) {
+				PROFILE_ZONE("wait for image encoders");
+				screenshots.room_cv.wait(lock, [&screenshots](){ return screenshots.images.size() < screenshots.max_images; });
+			}
+			screenshots.images.emplace_back(std::move(image));
+		}
+		screenshots.work_cv.notify_all();
+	}
+
+	//finish every readback, waiting for the GPU if needed:
+	void finish_readbacks(Screenshots &screenshots) {
+		//(in order, since images with the same filename should end up with the newest pixels -- and captured frames are numbered in order)
+		while (Readback *oldest = oldest_readback(screenshots)) {
+			finish_readback(screenshots, *oldest);
+		}
+	}
+
+	void start_readback(Screenshots &screenshots, std::string const &filename, glm::uvec2 const &size, GLenum buffer, PNGSaveOptions const &png, bool numbered, bool droppable) {
+		//use a readback that isn't in use, or else finish the oldest one:
+		Readback *readback = nullptr;
+		for (Readback &r : screenshots.readbacks) {
+			if (r.fence == 0) {
+				readback = &r;
+				break;
+			}
+		}
+		if (!readback) {
+			readback = oldest_readback(screenshots);
+			finish_readback(screenshots, *readback);
+		}
+
+		readback->order = screenshots.started++;
+		readback->size = size;
+		readback->filename = filename;
+		readback->numbered = numbered;
+		readback->droppable = droppable;
+		readback->png = png;
+
+		if (readback->buffer == 0) glGenBuffers(1, &readback->buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+		GLsizeiptr bytes = GLsizeiptr(size.x) * GLsizeiptr(size.y) * GLsizeiptr(sizeof(glm::u8vec4));
+		if (readback->buffer_size < bytes) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+			readback->buffer_size = bytes;
+		}
+
+		//with a pixel pack buffer bound, glReadPixels queues a copy into it (and returns right away):
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glReadBuffer(buffer);
+		glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glReadBuffer(GL_BACK);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		GL_ERRORS();
+	}
+}
+
+void Screenshot::save(std::string const &filename, glm::uvec2 const &size, GLenum buffer, PNGSaveOptions const &png) {
+	PROFILE_ZONE("Screenshot::save");
+	start_readback(get_screenshots(), filename, size, buffer, png, false, false);
+}
+
+void Screenshot::start_capture(CaptureSettings const &settings) {
+	Screenshots &screenshots = get_screenshots();
+	stop_capture();
+	screenshots.capturing = true;
+	screenshots.capture_settings = settings;
+	screenshots.capture_settings.every = std::max(1U, settings.every);
+	screenshots.capture_frames = 0;
+	screenshots.captured = 0;
+	{
+		std::unique_lock< std::mutex > lock(screenshots.mutex);
+		screenshots.dropped = 0;
+	}
+	std::cout << "Capturing " << (settings.every > 1 ? "every " + std::to_string(settings.every) + " frames" : std::string("every frame"))
+	          << " to '" << settings.prefix << "-*." << (settings.ppm ? "ppm" : "png") << "'." << std::endl;
+}
+
+void Screenshot::stop_capture() {
+	Screenshots &screenshots = get_screenshots();
+	if (!screenshots.capturing) return;
+	screenshots.capturing = false;
+	//(frames still on the GPU are numbered when they finish, so finish them before the settings change)
+	finish_readbacks(screenshots);
+	uint64_t dropped;
+	{
+		std::unique_lock< std::mutex > lock(screenshots.mutex);
+		dropped = screenshots.dropped;
+	}
+	std::cout << "Captured " << screenshots.captured << " frames";
+	if (dropped) std::cout << " (" << dropped << " dropped because encoding fell behind)";
+	std::cout << "." << std::endl;
+}
+
+bool Screenshot::capturing() {
+	return get_screenshots().capturing;
+}
+
+void Screenshot::capture(glm::uvec2 const &drawable_size) {
+	Screenshots &screenshots = get_screenshots();
+	if (!screenshots.capturing) return;
+	CaptureSettings const &settings = screenshots.capture_settings;
+	uint64_t frame = screenshots.capture_frames++;
+	if (frame % settings.every != 0) return;
+
+	PROFILE_ZONE("Screenshot::capture");
+	start_readback(screenshots, settings.prefix, drawable_size, GL_BACK, settings.png, true, settings.drop);
+}
+
+void Screenshot::update() {
+	Screenshots &screenshots = get_screenshots();
+	//finish (in order) every readback whose pixels have arrived:
+	while (Readback *oldest = oldest_readback(screenshots)) {
+		GLenum status = glClientWaitSync(oldest->fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+		finish_readback(screenshots, *oldest);
+	}
+}
+
+void Screenshot::finish() {
+	PROFILE_ZONE("Screenshot::finish");
+	Screenshots &screenshots = get_screenshots();
+	stop_capture();
+
+	finish_readbacks(screenshots);
+
+	//the encoding threads stop once they have written everything:
+	{
+		std::unique_lock< std::mutex > lock(screenshots.mutex);
+		screenshots.stopping = true;
+	}
+	screenshots.work_cv.notify_all();
+	for (auto &encoder : screenshots.encoders) {
+		encoder.join();
+	}
+	screenshots.encoders.clear();
+	screenshots.stopping = false;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+ * Screenshot saves the contents of the window to image files without stalling:
+ *  pixels are read into a pixel buffer object (which doesn't wait for the GPU),
+ *  copied out a frame or two later (once the GPU has finished with them),
+ *  and then encoded and written to disk by background threads.
+ *
+ * It can also capture a sequence of frames (e.g., to make a video of gameplay).
+ *
+ * Usage:
+ *   Screenshot::save("screenshot.png", drawable_size); //e.g., when a key is pressed
+ *   ...
+ *   Screenshot::capture(drawable_size); //once per frame, after drawing but before swapping
+ *   Screenshot::update(); //once per frame
+ *   ...
+ *   Screenshot::finish(); //before destroying the OpenGL context
+ *
+ */
+
+#include "GL.hpp"
+#include "load_save_png.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+
+namespace Screenshot {
+	//start saving the lower-left 'size' pixels of the default framebuffer's 'buffer' (GL_FRONT or GL_BACK) to 'filename':
+	// (filenames ending in ".ppm" are written as binary PPM -- much faster to write than PNG, but much larger -- others as PNG)
+	// (if many screenshots are already waiting on the GPU, this waits for the oldest one)
+	// (PNGs are compressed by several threads at once; see load_save_png.hpp for 'png' options)
+	void save(std::string const &filename, glm::uvec2 const &size, GLenum buffer = GL_FRONT, PNGSaveOptions const &png = PNGSaveOptions());
+
+	//----- continuous capture -----
+	struct CaptureSettings {
+		std::string prefix = "capture"; //frames are written to prefix-000000.png, prefix-000001.png, ... (numbered as they are written, so dropped frames leave no gaps)
+		uint32_t every = 1; //capture every Nth frame
+		bool ppm = false; //write .ppm files instead of .png
+		PNGSaveOptions png = PNGSaveOptions{1, PNGFilterAdaptive, 0}; //(fast compression by default, since frames keep coming)
+		bool drop = false; //if encoding falls behind, drop frames (instead of waiting for the encoders to catch up)
+	};
+	void start_capture(CaptureSettings const &settings);
+	void stop_capture(); //(waits for frames still on the GPU, then reports how many frames were captured and dropped)
+	bool capturing();
+
+	//when capturing, call once per frame after drawing (but before swapping) to capture the back buffer:
+	void capture(glm::uvec2 const &drawable_size);
+
+	//call once per frame to pass finished readbacks to the encoding threads:
+	void update();
+
+	//wait until every screenshot (and captured frame) has been written:
+	void finish();
+}
@@ -16,7 +16,7 @@ struct ShowMeshesMode : Mode {
 	virtual ~ShowMeshesMode();
 
 	virtual bool handle_event(SDL_Event const &, glm::uvec2 const &window_size) override;
-	virtual void draw(glm::uvec2 const &drawable_size) override;
+	virtual void draw(glm::uvec2 const &drawable_size, float alpha) override;
 
 	//z-up trackball-style camera controls:
 	struct {
@@ -36,6 +36,8 @@ struct ShowMeshesMode : Mode {
 	glm::vec3 current_mesh_max = glm::vec3(0.0f);
 	void select_prev_mesh();
 	void select_next_mesh();
+	void select_mesh(std::string const &name); //(selects nothing if name isn't in buffer)
+	std::vector< std::string > mesh_names; //all mesh names in buffer, sorted
 	
 	//Vertex array object used to bind mesh buffer for drawing:
 	GLuint vao = 0;
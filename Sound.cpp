@@ -1,6 +1,7 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "Profiler.hpp"
 
 #include <SDL.h>
 
@@ -39,6 +40,7 @@ void mix_audio(void *, Uint8 *buffer_, int len);
 //------------------------ public-facing --------------------------------
 
 Sound::Sample::Sample(std::string const &filename) {
+	PROFILE_ZONE("Sound::Sample::Sample");
 	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
 		load_wav(filename, &data);
 	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
@@ -312,6 +314,13 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
+	static bool named_thread = false; //(SDL always calls this from its audio thread)
+	if (!named_thread) {
+		profiler_set_thread_name("audio");
+		named_thread = true;
+	}
+	PROFILE_ZONE("mix_audio");
+
 	assert(buffer_); //should always have some audio buffer
 
 	struct LR {
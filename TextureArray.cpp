@@ -0,0 +1,181 @@
+#include "TextureArray.hpp"
+#include "ChunkFile.hpp"
+#include "Profiler.hpp"
+#include "load_save_png.hpp"
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+	struct Header {
+		uint32_t width, height, layers;
+	};
+	static_assert(sizeof(Header) == 12, "Header is packed.");
+
+	struct IndexEntry {
+		uint32_t name_begin, name_end;
+	};
+	static_assert(sizeof(IndexEntry) == 8, "Index entry is packed.");
+
+	//"dir/crate.png" => "crate":
+	std::string image_name(std::string const &filename) {
+		size_t begin = filename.find_last_of("/\\");
+		begin = (begin == std::string::npos ? 0 : begin + 1);
+		size_t end = filename.size();
+		if (end - begin >= 4 && filename.compare(end - 4, 4, ".png") == 0) end -= 4;
+		return filename.substr(begin, end - begin);
+	}
+
+	//bilinear resize of 'from' (of size 'from_size') to 'to_size', appended to 'to':
+	void stretch(glm::uvec2 from_size, std::vector< glm::u8vec4 > const &from, glm::uvec2 to_size, std::vector< glm::u8vec4 > *to) {
+		if (from_size == to_size) {
+			to->insert(to->end(), from.begin(), from.end());
+			return;
+		}
+		auto at = [&](int32_t x, int32_t y) {
+			x = std::max(0, std::min(x, int32_t(from_size.x) - 1));
+			y = std::max(0, std::min(y, int32_t(from_size.y) - 1));
+			return glm::vec4(from[size_t(y) * from_size.x + x]);
+		};
+		glm::vec2 scale = glm::vec2(from_size) / glm::vec2(to_size);
+		for (uint32_t y = 0; y < to_size.y; ++y) {
+			float fy = (y + 0.5f) * scale.y - 0.5f;
+			int32_t y0 = int32_t(std::floor(fy));
+			float ty = fy - y0;
+			for (uint32_t x = 0; x < to_size.x; ++x) {
+				float fx = (x + 0.5f) * scale.x - 0.5f;
+				int32_t x0 = int32_t(std::floor(fx));
+				float tx = fx - x0;
+				glm::vec4 bottom = glm::mix(at(x0, y0), at(x0 + 1, y0), tx);
+				glm::vec4 top = glm::mix(at(x0, y0 + 1), at(x0 + 1, y0 + 1), tx);
+				to->emplace_back(glm::u8vec4(glm::round(glm::mix(bottom, top, ty))));
+			}
+		}
+	}
+}
+
+void TextureArray::pack(std::vector< std::string > const &filenames, glm::uvec2 *size_, std::vector< glm::u8vec4 > *pixels_, std::vector< std::string > *names_) {
+	assert(size_ && pixels_ && names_);
+	PROFILE_ZONE("TextureArray::pack");
+	if (filenames.empty()) {
+		throw std::runtime_error("Can't pack an empty list of images.");
+	}
+
+	std::vector< glm::uvec2 > sizes(filenames.size());
+	std::vector< std::vector< glm::u8vec4 > > images(filenames.size());
+	glm::uvec2 size = glm::uvec2(0);
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		load_png(filenames[i], &sizes[i], &images[i], LowerLeftOrigin);
+		size = glm::max(size, sizes[i]);
+	}
+	if (size.x == 0 || size.y == 0) {
+		throw std::runtime_error("Can't pack images that are all empty.");
+	}
+
+	pixels_->clear();
+	pixels_->reserve(size_t(size.x) * size.y * images.size());
+	names_->clear();
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		if (sizes[i].x == 0 || sizes[i].y == 0) {
+			throw std::runtime_error("Image '" + filenames[i] + "' is empty.");
+		}
+		stretch(sizes[i], images[i], size, pixels_);
+		names_->emplace_back(image_name(filenames[i]));
+	}
+	*size_ = size;
+}
+
+TextureArray::TextureArray(std::string const &filename, Upload when) {
+	PROFILE_ZONE("TextureArray::TextureArray");
+	//(pixels are uploaded directly from the mapped file)
+	pending_file.reset(new ChunkFile(filename));
+	ChunkFile &file = *pending_file;
+
+	ChunkSpan< Header > header = file.read< Header >("tas0");
+	if (header.size() != 1) {
+		throw std::runtime_error("Texture array '" + filename + "' should have exactly one header.");
+	}
+	size = glm::uvec2(header[0].width, header[0].height);
+	layers = header[0].layers;
+
+	ChunkSpan< glm::u8vec4 > pixels = file.read< glm::u8vec4 >("rgba");
+	if (pixels.size() != size_t(size.x) * size.y * layers) {
+		throw std::runtime_error("Texture array '" + filename + "' has the wrong number of pixels for its size.");
+	}
+	pending_data = pixels.data();
+
+	ChunkSpan< char > strings = file.read< char >("str0");
+	ChunkSpan< IndexEntry > index = file.read< IndexEntry >("idx0");
+	if (index.size() != layers) {
+		throw std::runtime_error("Texture array '" + filename + "' should have one index entry per layer.");
+	}
+	for (uint32_t layer = 0; layer < layers; ++layer) {
+		IndexEntry const &entry = index[layer];
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+			throw std::runtime_error("index entry has out-of-range name begin/end");
+		}
+		std::string name(strings.begin() + entry.name_begin, strings.begin() + entry.name_end);
+		if (!names.insert(name, layer)) {
+			std::cerr << "WARNING: image name '" + name + "' in texture array '" + filename + "' collides with existing image." << std::endl;
+		}
+	}
+
+	if (!file.at_end()) {
+		std::cerr << "WARNING: trailing data in texture array file '" << filename << "'" << std::endl;
+	}
+
+	if (when == UploadNow) upload();
+}
+
+TextureArray::TextureArray(std::vector< std::string > const &filenames, Upload when) {
+	std::vector< std::string > image_names;
+	pack(filenames, &size, &packed, &image_names);
+	layers = uint32_t(image_names.size());
+	pending_data = packed.data();
+	for (uint32_t layer = 0; layer < layers; ++layer) {
+		if (!names.insert(image_names[layer], layer)) {
+			std::cerr << "WARNING: image name '" + image_names[layer] + "' (from '" + filenames[layer] + "') collides with existing image." << std::endl;
+		}
+	}
+
+	if (when == UploadNow) upload();
+}
+
+TextureArray::~TextureArray() {
+	if (texture != 0) {
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+}
+
+void TextureArray::upload() {
+	if (!pending_data) return; //already uploaded
+	PROFILE_ZONE("TextureArray::upload");
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size.x, size.y, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pending_data);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	GL_ERRORS();
+
+	//(the pixels are no longer needed)
+	pending_file.reset();
+	packed = std::vector< glm::u8vec4 >();
+	pending_data = nullptr;
+}
+
+uint32_t TextureArray::lookup(HashedName const &name) const {
+	uint32_t const *layer = names.find(name);
+	if (!layer) {
+		throw std::runtime_error("Looking up image '" + name.str() + "' that doesn't exist.");
+	}
+	return *layer;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ * A TextureArray packs many images into the layers of one GL_TEXTURE_2D_ARRAY,
+ *  so drawables using any of them share a texture binding: submit() doesn't
+ *  rebind between them, and drawables with the same mesh are instanced
+ *  together even when they show different images.
+ *
+ * Images are looked up by name (their filename, without directory or ".png").
+ * Every layer is the same size; smaller images are stretched to fit, so texture
+ *  coordinates (including repeating ones) don't need to change.
+ *
+ * Arrays can be packed when loading, from a list of PNG files, or ahead of time
+ *  by the 'pack-textures' tool into a ".tarr" file (which loads much faster,
+ *  since nothing needs to be decoded or resized).
+ *
+ * Usage:
+ *   Load< TextureArray > props_textures(LoadTagDefault, []() -> TextureArray const * {
+ *       return new TextureArray(data_path("props.tarr"));
+ *   });
+ *   ...
+ *   drawable.pipeline = lit_color_texture_program_pipeline; //(with a texture_array variant's program)
+ *   drawable.pipeline.textures[0].texture = props_textures->texture;
+ *   drawable.pipeline.textures[0].target = GL_TEXTURE_2D_ARRAY;
+ *   drawable.pipeline.texture_layer = props_textures->lookup("crate");
+ *
+ */
+
+#include "GL.hpp"
+#include "HashedName.hpp"
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ChunkFile;
+
+struct TextureArray {
+	//construct from a ".tarr" file (made by pack-textures):
+	// note: will throw if file fails to read.
+	// with UploadLater, doesn't use OpenGL (so can run on a loading thread); call upload() on the OpenGL thread before drawing.
+	enum Upload { UploadNow, UploadLater };
+	TextureArray(std::string const &filename, Upload when = UploadNow);
+
+	//...or pack a list of PNG files:
+	// note: will throw if any file fails to load.
+	TextureArray(std::vector< std::string > const &filenames, Upload when = UploadNow);
+
+	~TextureArray(); //(deletes 'texture')
+
+	//textures aren't copyable:
+	TextureArray(TextureArray const &) = delete;
+	TextureArray &operator=(TextureArray const &) = delete;
+
+	//copy pixels into 'texture' (and make mipmaps):
+	void upload();
+
+	//look up the layer holding a particular image:
+	// note: will throw if image not found.
+	uint32_t lookup(HashedName const &name) const;
+
+	//the GL_TEXTURE_2D_ARRAY holding every image:
+	GLuint texture = 0;
+	glm::uvec2 size = glm::uvec2(0); //of each layer
+	uint32_t layers = 0;
+
+	//-- internals ---
+
+	//layer of each image, by name (entries in layer order):
+	FlatNameMap< uint32_t > names;
+
+	//pixels waiting for upload() (in the mapped file, or in 'packed'), layer by layer, rows bottom-to-top:
+	std::unique_ptr< ChunkFile > pending_file;
+	std::vector< glm::u8vec4 > packed;
+	glm::u8vec4 const *pending_data = nullptr;
+
+	//load images and stretch them to a common size (the largest width and height among them):
+	// (used by the constructor above and by pack-textures)
+	// note: will throw if any file fails to load.
+	static void pack(std::vector< std::string > const &filenames, glm::uvec2 *size, std::vector< glm::u8vec4 > *pixels, std::vector< std::string > *names);
+};
@@ -0,0 +1,273 @@
+#include "TextureStream.hpp"
+
+#include "load_save_png.hpp"
+#include "Profiler.hpp"
+#include "gl_errors.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+size_t TextureStream::upload_budget = 4 * 1024 * 1024;
+
+namespace {
+	//(static initialization runs on the main thread, before main())
+	std::thread::id const main_thread = std::this_thread::get_id();
+
+	struct Texture {
+		GLuint name = 0;
+		std::string filename;
+		GLenum wrap = GL_REPEAT;
+
+		//filled in by a decoding thread:
+		// (then only touched by the main thread, once the texture is taken from Streamer::decoded)
+		bool decode_failed = false;
+		struct Level {
+			glm::uvec2 size;
+			size_t offset; //first pixel of this level in 'pixels'
+		};
+		std::vector< Level > levels; //largest first
+		std::vector< glm::u8vec4 > pixels; //every level's pixels, rows bottom-to-top
+
+		//upload progress (main thread only):
+		bool allocated = false; //have the levels been allocated (replacing the placeholder)?
+		uint32_t level = 0; //level being uploaded (counting down from the smallest)
+		uint32_t row = 0; //rows of that level uploaded so far
+		bool loaded = false;
+		bool failed = false; //(set from decode_failed once the texture is taken from Streamer::decoded)
+	};
+
+	//make each mipmap level by averaging 2x2 blocks of the level above:
+	// (odd-sized levels just repeat their last row/column)
+	void make_mipmaps(Texture *texture, glm::uvec2 size, std::vector< glm::u8vec4 > &&data) {
+		texture->levels.clear();
+		texture->levels.emplace_back(Texture::Level{ size, 0 });
+		while (texture->levels.back().size != glm::uvec2(1)) {
+			Texture::Level const &above = texture->levels.back();
+			glm::uvec2 next = glm::max(glm::uvec2(1), above.size / 2U);
+			texture->levels.emplace_back(Texture::Level{ next, above.offset + size_t(above.size.x) * above.size.y });
+		}
+		Texture::Level const &smallest = texture->levels.back();
+		data.resize(smallest.offset + 1);
+
+		for (size_t l = 1; l < texture->levels.size(); ++l) {
+			Texture::Level const &src = texture->levels[l-1];
+			Texture::Level const &dst = texture->levels[l];
+			auto at = [&](uint32_t x, uint32_t y) -> glm::uvec4 {
+				x = std::min(x, src.size.x - 1);
+				y = std::min(y, src.size.y - 1);
+				return glm::uvec4(data[src.offset + size_t(y) * src.size.x + x]);
+			};
+			for (uint32_t y = 0; y < dst.size.y; ++y) {
+				for (uint32_t x = 0; x < dst.size.x; ++x) {
+					glm::uvec4 sum = at(2*x, 2*y) + at(2*x+1, 2*y) + at(2*x, 2*y+1) + at(2*x+1, 2*y+1);
+					data[dst.offset + size_t(y) * dst.size.x + x] = glm::u8vec4((sum + glm::uvec4(2)) / 4U);
+				}
+			}
+		}
+		texture->pixels = std::move(data);
+	}
+
+	struct Streamer {
+		//textures by (filename, wrap); map nodes don't move, so Texture pointers stay valid:
+		std::map< std::pair< std::string, GLenum >, Texture > textures;
+		std::unordered_map< GLuint, Texture * > by_name;
+		std::deque< Texture * > uploading; //decoded textures, in the order they will be uploaded (main thread only)
+		size_t unloaded = 0; //textures not yet loaded
+
+		//everything below is guarded by 'mutex':
+		std::mutex mutex;
+		std::condition_variable work_cv; //signalled when 'to_decode' gets a texture (or stopping is set)
+		std::deque< Texture * > to_decode;
+		std::deque< Texture * > decoded;
+		bool stopping = false;
+
+		std::vector< std::thread > decoders; //(started by the first get(); stopped by finish())
+
+		void decode() {
+			profiler_set_thread_name("texture decoder");
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				work_cv.wait(lock, [this](){ return stopping || !to_decode.empty(); });
+				if (stopping) return;
+				Texture *texture = to_decode.front();
+				to_decode.pop_front();
+
+				lock.unlock();
+				try {
+					PROFILE_ZONE("decode texture");
+					glm::uvec2 size;
+					std::vector< glm::u8vec4 > data;
+					load_png(texture->filename, &size, &data, LowerLeftOrigin);
+					if (size.x == 0 || size.y == 0) {
+						throw std::runtime_error("Texture '" + texture->filename + "' is empty.");
+					}
+					make_mipmaps(texture, size, std::move(data));
+				} catch (std::exception &e) {
+					std::cerr << "Failed to load texture: " << e.what() << std::endl;
+					texture->decode_failed = true;
+				}
+				lock.lock();
+
+				decoded.emplace_back(texture);
+			}
+		}
+
+		//upload (some of) the next level of 'texture'; returns the bytes uploaded:
+		size_t upload(Texture &texture, size_t budget) {
+			glBindTexture(GL_TEXTURE_2D, texture.name);
+			if (!texture.allocated) {
+				//replace the placeholder with (empty) storage for every level:
+				for (uint32_t l = 0; l < texture.levels.size(); ++l) {
+					glm::uvec2 size = texture.levels[l].size;
+					glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+				}
+				texture.level = uint32_t(texture.levels.size()) - 1;
+				texture.row = 0;
+				//GL_TEXTURE_BASE_LEVEL follows the uploads (starting with the smallest level, which is uploaded right away):
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.level);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				texture.allocated = true;
+			}
+
+			//upload as many rows as fit in the budget (but always at least one, so big levels still make progress):
+			Texture::Level const &level = texture.levels[texture.level];
+			size_t row_bytes = size_t(level.size.x) * sizeof(glm::u8vec4);
+			uint32_t rows = uint32_t(std::min< size_t >(level.size.y - texture.row, std::max< size_t >(1, budget / row_bytes)));
+			glTexSubImage2D(GL_TEXTURE_2D, texture.level, 0, texture.row, level.size.x, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+				texture.pixels.data() + level.offset + size_t(texture.row) * level.size.x);
+			texture.row += rows;
+
+			if (texture.row == level.size.y) {
+				//the level is complete, so it can be sampled:
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.level);
+				if (texture.level == 0) {
+					texture.loaded = true;
+					texture.pixels = std::vector< glm::u8vec4 >(); //(free staging memory)
+				} else {
+					texture.level -= 1;
+					texture.row = 0;
+				}
+			}
+			glBindTexture(GL_TEXTURE_2D, 0);
+			GL_ERRORS();
+
+			return size_t(rows) * row_bytes;
+		}
+	};
+
+	Streamer &get_streamer() {
+		static Streamer streamer;
+		return streamer;
+	}
+}
+
+GLuint TextureStream::get(std::string const &filename, GLenum wrap) {
+	//(so a two-stage Load<>'s cpu_fn -- which runs on a loading worker thread -- can't call this)
+	assert(std::this_thread::get_id() == main_thread);
+	Streamer &streamer = get_streamer();
+	auto ret = streamer.textures.emplace(std::make_pair(filename, wrap), Texture());
+	Texture &texture = ret.first->second;
+	if (!ret.second) return texture.name;
+
+	texture.filename = filename;
+	texture.wrap = wrap;
+
+	//start out as one white pixel:
+	glGenTextures(1, &texture.name);
+	glBindTexture(GL_TEXTURE_2D, texture.name);
+	glm::u8vec4 white(0xff);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	GL_ERRORS();
+
+	streamer.by_name.emplace(texture.name, &texture);
+	streamer.unloaded += 1;
+
+	{
+		std::unique_lock< std::mutex > lock(streamer.mutex);
+		streamer.to_decode.emplace_back(&texture);
+		if (streamer.decoders.empty()) {
+			//decoding is slow, but leave most cores for everything else:
+			uint32_t count = std::max(1U, std::min(4U, std::thread::hardware_concurrency() / 2));
+			for (uint32_t i = 0; i < count; ++i) {
+				streamer.decoders.emplace_back(&Streamer::decode, &streamer);
+			}
+		}
+	}
+	streamer.work_cv.notify_one();
+
+	return texture.name;
+}
+
+bool TextureStream::loaded(GLuint texture) {
+	Streamer &streamer = get_streamer();
+	auto f = streamer.by_name.find(texture);
+	if (f == streamer.by_name.end()) return true;
+	return f->second->loaded || f->second->failed;
+}
+
+size_t TextureStream::pending() {
+	return get_streamer().unloaded;
+}
+
+void TextureStream::update() {
+	Streamer &streamer = get_streamer();
+	if (streamer.unloaded == 0) return;
+	PROFILE_ZONE("TextureStream::update");
+
+	{ //take newly-decoded textures:
+		std::unique_lock< std::mutex > lock(streamer.mutex);
+		for (Texture *texture : streamer.decoded) {
+			if (texture->decode_failed) {
+				texture->failed = true;
+				streamer.unloaded -= 1;
+			} else {
+				streamer.uploading.emplace_back(texture);
+			}
+		}
+		streamer.decoded.clear();
+	}
+
+	//upload, one texture at a time (so each one finishes as soon as possible):
+	size_t budget = upload_budget;
+	while (budget > 0 && !streamer.uploading.empty()) {
+		Texture &texture = *streamer.uploading.front();
+		budget -= std::min(budget, streamer.upload(texture, budget));
+		if (texture.loaded) {
+			streamer.uploading.pop_front();
+			streamer.unloaded -= 1;
+		}
+	}
+}
+
+void TextureStream::finish() {
+	Streamer &streamer = get_streamer();
+	{
+		std::unique_lock< std::mutex > lock(streamer.mutex);
+		streamer.stopping = true;
+		streamer.to_decode.clear();
+	}
+	streamer.work_cv.notify_all();
+	for (auto &decoder : streamer.decoders) {
+		decoder.join();
+	}
+	streamer.decoders.clear();
+	streamer.stopping = false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+/*
+ * TextureStream loads textures from PNG files without stalling the game:
+ *  files are decoded (and their mipmaps made) by background threads,
+ *  then uploaded a few megabytes per frame -- smallest mip level first, so
+ *  textures start out blurry and sharpen as their larger levels arrive.
+ *
+ * Textures can be used right away; until a texture has loaded, it is a
+ *  single white pixel (so it just shows vertex colors).
+ *
+ * Usage:
+ *   //e.g., in a tagged Load<> function (which runs on the main thread):
+ *   pipeline.textures[0].texture = TextureStream::get(data_path("crate.png"));
+ *   //(get() makes OpenGL calls, so it can't be called from a two-stage Load<>'s cpu_fn --
+ *   // which runs on a worker thread -- only from its gl_fn)
+ *   ...
+ *   TextureStream::update(); //once per frame, on the main thread
+ *   ...
+ *   TextureStream::finish(); //before exiting
+ *
+ */
+
+#include "GL.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace TextureStream {
+	//get a texture (to use with Scene::Drawable::Pipeline::textures) that will show the image in 'filename':
+	// (asking again for the same file -- and wrap mode -- returns the same texture)
+	// (only call on the main thread -- this is asserted; if the file can't be loaded, an error is printed and the texture stays white)
+	GLuint get(std::string const &filename, GLenum wrap = GL_REPEAT);
+
+	//has every mip level of 'texture' been uploaded?
+	// (textures that failed to load count as loaded; textures not from get() are always loaded)
+	bool loaded(GLuint texture);
+
+	//textures asked for with get() that haven't finished loading:
+	size_t pending();
+
+	//upload decoded pixels (up to about upload_budget bytes of them):
+	// (call once per frame on the main thread)
+	void update();
+	extern size_t upload_budget; //(4 MiB by default -- i.e., one 1024x1024 image)
+
+	//stop the decoding threads:
+	// (textures stay around -- like Load<>s, they are not freed at exit)
+	void finish();
+}
@@ -0,0 +1,371 @@
+//Renders frames of a scene offscreen, and reports how long each took.
+// (on Linux, uses an EGL context -- so it runs without a display or GPU, e.g. on Mesa's llvmpipe)
+
+#include "ShowSceneMode.hpp"
+#include "ShowSceneProgram.hpp"
+#include "Load.hpp"
+#include "GL.hpp"
+#include "gl_errors.hpp"
+#include "load_save_png.hpp"
+#include "FrameStats.hpp"
+
+#include <SDL.h>
+
+#ifdef __linux__
+#define BENCHMARK_EGL
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//------------ offscreen OpenGL contexts --------------
+
+#ifdef BENCHMARK_EGL
+//an EGL context (on Mesa's "surfaceless" platform, if available), with a tiny pbuffer to be current with:
+struct EGLOffscreen {
+	EGLOffscreen() {
+		char const *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		if (client_extensions && std::strstr(client_extensions, "EGL_MESA_platform_surfaceless")) {
+			auto get_platform_display = reinterpret_cast< PFNEGLGETPLATFORMDISPLAYEXTPROC >(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+			if (get_platform_display) display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+		if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major = 0, minor = 0;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+			throw std::runtime_error("Failed to initialize EGL.");
+		}
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			throw std::runtime_error("EGL doesn't support OpenGL.");
+		}
+
+		EGLint const config_attribs[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint configs = 0;
+		if (!eglChooseConfig(display, config_attribs, &config, 1, &configs) || configs == 0) {
+			throw std::runtime_error("Failed to find an EGL config for OpenGL with pbuffers.");
+		}
+
+		//(same version as the game asks SDL for)
+		EGLint const context_attribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+		if (context == EGL_NO_CONTEXT) {
+			throw std::runtime_error("Failed to create an OpenGL 3.3 core context with EGL.");
+		}
+
+		//(everything is drawn to a framebuffer object, so this surface just needs to exist)
+		EGLint const pbuffer_attribs[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+		if (surface == EGL_NO_SURFACE) {
+			throw std::runtime_error("Failed to create an EGL pbuffer.");
+		}
+
+		if (!eglMakeCurrent(display, surface, surface, context)) {
+			throw std::runtime_error("Failed to make EGL context current.");
+		}
+		std::cerr << "Using EGL " << major << "." << minor << "." << std::endl;
+	}
+	~EGLOffscreen() {
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+		if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+		eglTerminate(display);
+	}
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLSurface surface = EGL_NO_SURFACE;
+};
+#endif //BENCHMARK_EGL
+
+//a hidden SDL window (for platforms without EGL, or when asked for with --window):
+struct SDLOffscreen {
+	SDLOffscreen() {
+		SDL_Init(SDL_INIT_VIDEO);
+
+		SDL_GL_ResetAttributes();
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+
+		window = SDL_CreateWindow("benchmark", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 16, 16, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+		if (!window) {
+			throw std::runtime_error(std::string("Error creating SDL window: ") + SDL_GetError());
+		}
+		context = SDL_GL_CreateContext(window);
+		if (!context) {
+			SDL_DestroyWindow(window);
+			throw std::runtime_error(std::string("Error creating OpenGL context: ") + SDL_GetError());
+		}
+	}
+	~SDLOffscreen() {
+		SDL_GL_DeleteContext(context);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+	}
+	SDL_Window *window = nullptr;
+	SDL_GLContext context = nullptr;
+};
+
+//------------ reporting --------------
+
+static float percentile(std::vector< float > values, float p) {
+	if (values.empty()) return 0.0f;
+	std::sort(values.begin(), values.end());
+	size_t i = size_t(p * float(values.size() - 1) + 0.5f);
+	return values[std::min(i, values.size() - 1)];
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	//------------ command line --------------
+	std::string scene_file;
+	std::string meshes_file;
+	std::string png_file;
+	uint32_t frames = 300;
+	uint32_t warmup = 10;
+	glm::uvec2 size(1280, 720);
+	bool use_window = false;
+
+	bool usage = false;
+	std::vector< std::string > positional;
+	for (int a = 1; a < argc; ++a) {
+		std::string arg = argv[a];
+		bool has_value = (a + 1 < argc);
+		if (arg == "--frames" && has_value) {
+			frames = uint32_t(std::max(1, std::atoi(argv[++a])));
+		} else if (arg == "--warmup" && has_value) {
+			warmup = uint32_t(std::max(0, std::atoi(argv[++a])));
+		} else if (arg == "--size" && has_value) {
+			int w = 0, h = 0;
+			if (std::sscanf(argv[++a], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) usage = true;
+			size = glm::uvec2(w, h);
+		} else if (arg == "--png" && has_value) {
+			png_file = argv[++a];
+		} else if (arg == "--window") {
+			use_window = true;
+		} else if (arg.substr(0, 2) == "--") {
+			usage = true;
+		} else {
+			positional.emplace_back(arg);
+		}
+	}
+	if (positional.size() == 2) {
+		scene_file = positional[0];
+		meshes_file = positional[1];
+	} else {
+		usage = true;
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <path/to/scene.scene> <path/to/meshes.pnct>"
+			" [--frames N] [--warmup N] [--size WxH] [--png final-frame.png] [--window]\n"
+			"Renders frames of the scene (orbiting the camera once) offscreen, then prints per-frame times (in milliseconds) as CSV on stdout and a summary on stderr." << std::endl;
+		return 1;
+	}
+
+	//------------ OpenGL context --------------
+	std::unique_ptr< SDLOffscreen > sdl_offscreen;
+#ifdef BENCHMARK_EGL
+	std::unique_ptr< EGLOffscreen > egl_offscreen;
+	if (!use_window) egl_offscreen.reset(new EGLOffscreen);
+#else
+	use_window = true;
+#endif
+	if (use_window) sdl_offscreen.reset(new SDLOffscreen);
+
+	//On windows, load OpenGL entrypoints: (does nothing on other platforms)
+	init_GL();
+
+	std::cerr << "Rendering with " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")." << std::endl;
+
+	//------------ load resources --------------
+	call_load_functions();
+
+	//(this matches show-scene)
+	MeshBuffer const *buffer = new MeshBuffer(meshes_file);
+	GLuint buffer_vao = buffer->make_vao_for_program(show_scene_program->program);
+
+	Scene scene;
+	scene.load(scene_file, [&buffer,&buffer_vao](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+		Mesh const &mesh = buffer->lookup(mesh_name);
+
+		scene.drawables.emplace_back(transform);
+		Scene::Drawable &drawable = scene.drawables.back();
+
+		drawable.pipeline = show_scene_program_pipeline;
+
+		drawable.pipeline.vao = buffer_vao;
+		drawable.pipeline.type = mesh.type;
+		drawable.pipeline.start = mesh.start;
+		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.min = mesh.min;
+		drawable.pipeline.max = mesh.max;
+	});
+
+	//------------ framebuffer to draw into --------------
+	GLuint color_rb = 0, depth_rb = 0, fb = 0;
+	glGenRenderbuffers(1, &color_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size.x, size.y);
+	glGenRenderbuffers(1, &depth_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, size.x, size.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("Offscreen framebuffer is incomplete.");
+	}
+	glViewport(0, 0, size.x, size.y);
+	GL_ERRORS();
+
+	//------------ render --------------
+
+	//view the scene the way show-scene does, from far enough away to see every transform:
+	ShowSceneMode mode(scene);
+	{
+		glm::vec3 min(std::numeric_limits< float >::infinity());
+		glm::vec3 max(-std::numeric_limits< float >::infinity());
+		for (auto const &transform : scene.transforms) {
+			glm::vec3 position = transform.make_local_to_world()[3];
+			min = glm::min(min, position);
+			max = glm::max(max, position);
+		}
+		if (min.x <= max.x) {
+			mode.camera.target = 0.5f * (min + max);
+			mode.camera.radius = std::max(2.0f, 1.5f * glm::length(max - min));
+		}
+	}
+
+	//like a swap chain, let the CPU get at most this many frames ahead of the GPU:
+	constexpr uint32_t MaxFramesInFlight = 2;
+	std::deque< GLsync > in_flight;
+
+	std::vector< FrameStats::Times > results;
+	uint64_t first_reported = 0; //(frame number, from FrameStats, of the first frame after warm-up)
+	uint64_t next_result = 0;
+	auto collect_results = [&](bool all) {
+		FrameStats::Times times;
+		while (next_result != 0 && next_result < FrameStats::current_frame() && FrameStats::get_times(next_result, &times)) {
+			if (!times.gpu_done && !all) break;
+			results.emplace_back(times);
+			next_result += 1;
+		}
+	};
+
+	for (uint32_t i = 0; i < warmup + frames; ++i) {
+		FrameStats::begin_frame();
+		if (i == warmup) {
+			first_reported = FrameStats::current_frame();
+			next_result = first_reported;
+		}
+
+		mode.camera.azimuth = 2.0f * 3.1415926f * float(i % frames) / float(frames) - 3.1415926f;
+		mode.draw(size, 1.0f);
+
+		FrameStats::end_frame();
+
+		in_flight.emplace_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		glFlush();
+		while (in_flight.size() > MaxFramesInFlight) {
+			glClientWaitSync(in_flight.front(), GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(10) * 1000000000);
+			glDeleteSync(in_flight.front());
+			in_flight.pop_front();
+		}
+
+		collect_results(false);
+	}
+	FrameStats::begin_frame(); //(so the last frame's length is known)
+	FrameStats::wait_for_gpu();
+	collect_results(true);
+	for (GLsync sync : in_flight) glDeleteSync(sync);
+	in_flight.clear();
+
+	if (results.size() != frames) {
+		std::cerr << "NOTE: only " << results.size() << " of " << frames << " frames were still stored to report." << std::endl;
+	}
+
+	//------------ report --------------
+	std::cout << "frame,frame_ms,cpu_ms,gpu_ms,scene_gpu_ms,lines_gpu_ms,draw_calls,triangles\n";
+	std::vector< float > frame_ms, cpu_ms, gpu_ms;
+	for (uint32_t i = 0; i < results.size(); ++i) {
+		FrameStats::Times const &t = results[i];
+		float gpu = t.gpu_ms[FrameStats::ScenePass] + t.gpu_ms[FrameStats::LinesPass];
+		std::cout << i << ',' << t.frame_ms << ',' << t.cpu_ms << ',' << gpu
+			<< ',' << t.gpu_ms[FrameStats::ScenePass] << ',' << t.gpu_ms[FrameStats::LinesPass]
+			<< ',' << t.draw_calls << ',' << t.triangles << '\n';
+		frame_ms.emplace_back(t.frame_ms);
+		cpu_ms.emplace_back(t.cpu_ms);
+		gpu_ms.emplace_back(gpu);
+	}
+	std::cout.flush();
+
+	auto summary = [](std::string const &name, std::vector< float > const &values) {
+		std::cerr << name << " ms: p50 " << percentile(values, 0.50f) << ", p95 " << percentile(values, 0.95f) << ", p99 " << percentile(values, 0.99f) << ", max " << percentile(values, 1.0f) << std::endl;
+	};
+	std::cerr << results.size() << " frames at " << size.x << "x" << size.y << ":" << std::endl;
+	summary("frame", frame_ms);
+	summary("  cpu", cpu_ms);
+	summary("  gpu", gpu_ms);
+
+	//------------ final frame --------------
+	if (!png_file.empty()) {
+		std::vector< glm::u8vec4 > data(size.x * size.y);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fb);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+		for (auto &px : data) {
+			px.a = 0xff;
+		}
+		std::cerr << "Saving final frame to '" << png_file << "'." << std::endl;
+		save_png(png_file, size, data.data(), LowerLeftOrigin);
+	}
+
+	//------------  teardown ------------
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fb);
+	glDeleteRenderbuffers(1, &depth_rb);
+	glDeleteRenderbuffers(1, &color_rb);
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
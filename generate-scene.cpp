@@ -0,0 +1,314 @@
+//Writes a synthetic '.scene' and '.pnct' (in the formats read by Scene::load and MeshBuffer)
+// with as many transforms, meshes, lights, and cameras as asked for -- useful for testing
+// how loading, copying, culling, and drawing scale.
+
+#include "read_write_chunk.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+//------------ file contents (must match Scene::load and MeshBuffer::MeshBuffer) --------------
+
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+};
+static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+
+struct HierarchyEntry {
+	uint32_t parent;
+	uint32_t name_begin;
+	uint32_t name_end;
+	glm::vec3 position;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
+
+struct MeshEntry {
+	uint32_t transform;
+	uint32_t name_begin;
+	uint32_t name_end;
+};
+static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
+
+struct CameraEntry {
+	uint32_t transform;
+	char type[4]; //"pers" or "orth"
+	float data; //fov in degrees for 'pers', scale for 'orth'
+	float clip_near, clip_far;
+};
+static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
+
+struct LightEntry {
+	uint32_t transform;
+	char type;
+	glm::u8vec3 color;
+	float energy;
+	float distance;
+	float fov;
+};
+static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
+
+//------------ helpers --------------
+
+//(std::uniform_real_distribution may differ between standard libraries; this doesn't, so a seed always makes the same files)
+struct Random {
+	Random(uint32_t seed) : mt(seed) { }
+	float operator()() { return float(mt() >> 8) / float(1 << 24); } //[0,1)
+	float operator()(float min, float max) { return min + (max - min) * (*this)(); }
+	glm::quat rotation() {
+		//uniformly distributed unit quaternion (Shoemake's method):
+		float u1 = (*this)(), u2 = (*this)(), u3 = (*this)();
+		float a = std::sqrt(1.0f - u1), b = std::sqrt(u1);
+		return glm::quat(
+			b * std::cos(6.2831853f * u3),
+			a * std::sin(6.2831853f * u2),
+			a * std::cos(6.2831853f * u2),
+			b * std::sin(6.2831853f * u3)
+		);
+	}
+	glm::u8vec4 color() {
+		//(braces, unlike parentheses, evaluate their arguments in order)
+		return glm::u8vec4{uint8_t(64 + 191 * (*this)()), uint8_t(64 + 191 * (*this)()), uint8_t(64 + 191 * (*this)()), 0xff};
+	}
+	std::mt19937 mt;
+};
+
+//append a name to 'strings', returning its [begin,end):
+static std::pair< uint32_t, uint32_t > add_name(std::vector< char > *strings, std::string const &name) {
+	uint32_t begin = uint32_t(strings->size());
+	strings->insert(strings->end(), name.begin(), name.end());
+	return std::make_pair(begin, uint32_t(strings->size()));
+}
+
+//a box with half-extents 'radius':
+static void make_box(glm::vec3 const &radius, glm::u8vec4 const &color, std::vector< Vertex > *vertices) {
+	for (uint32_t axis = 0; axis < 3; ++axis) {
+		for (float sign : { -1.0f, 1.0f }) {
+			glm::vec3 n(0.0f); n[axis] = sign;
+			glm::vec3 u(0.0f); u[(axis + 1) % 3] = 1.0f;
+			glm::vec3 v = glm::cross(n, u);
+			auto corner = [&](float a, float b) {
+				Vertex vertex;
+				vertex.Position = radius * (n + a * u + b * v);
+				vertex.Normal = n;
+				vertex.Color = color;
+				vertex.TexCoord = glm::vec2(0.5f * a + 0.5f, 0.5f * b + 0.5f);
+				vertices->emplace_back(vertex);
+			};
+			corner(-1.0f,-1.0f); corner( 1.0f,-1.0f); corner( 1.0f, 1.0f);
+			corner(-1.0f,-1.0f); corner( 1.0f, 1.0f); corner(-1.0f, 1.0f);
+		}
+	}
+}
+
+//a sphere with 'segments' segments around and segments/2 rings:
+static void make_sphere(float radius, uint32_t segments, glm::u8vec4 const &color, std::vector< Vertex > *vertices) {
+	uint32_t rings = std::max(2U, segments / 2);
+	auto point = [&](uint32_t s, uint32_t r) {
+		float theta = 6.2831853f * float(s) / float(segments);
+		float phi = 3.1415926f * float(r) / float(rings);
+		Vertex vertex;
+		vertex.Normal = glm::vec3(std::cos(theta) * std::sin(phi), std::sin(theta) * std::sin(phi), std::cos(phi));
+		vertex.Position = radius * vertex.Normal;
+		vertex.Color = color;
+		vertex.TexCoord = glm::vec2(float(s) / float(segments), float(r) / float(rings));
+		return vertex;
+	};
+	for (uint32_t r = 0; r < rings; ++r) {
+		for (uint32_t s = 0; s < segments; ++s) {
+			Vertex a = point(s, r), b = point(s + 1, r), c = point(s + 1, r + 1), d = point(s, r + 1);
+			if (r != 0) { vertices->emplace_back(a); vertices->emplace_back(d); vertices->emplace_back(b); }
+			if (r + 1 != rings) { vertices->emplace_back(b); vertices->emplace_back(d); vertices->emplace_back(c); }
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	//------------ command line --------------
+	std::string output;
+	uint32_t transforms = 1000;
+	uint32_t depth = 1;
+	uint32_t meshes = 16;
+	uint32_t lights = 8;
+	uint32_t cameras = 1;
+	uint32_t detail = 16;
+	uint32_t seed = 1;
+
+	bool usage = false;
+	for (int a = 1; a < argc; ++a) {
+		std::string arg = argv[a];
+		auto count = [&](uint32_t min) -> uint32_t {
+			if (a + 1 >= argc) {
+				usage = true;
+				return min;
+			}
+			return uint32_t(std::max(long(min), std::atol(argv[++a])));
+		};
+		if (arg == "--transforms") transforms = count(1);
+		else if (arg == "--depth") depth = count(1);
+		else if (arg == "--meshes") meshes = count(1);
+		else if (arg == "--lights") lights = count(0);
+		else if (arg == "--cameras") cameras = count(0);
+		else if (arg == "--detail") detail = count(3);
+		else if (arg == "--seed") seed = count(0);
+		else if (arg.substr(0, 2) != "--" && output.empty()) output = arg;
+		else usage = true;
+	}
+	if (output.empty()) usage = true;
+	if (usage) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <path/to/output> [--transforms N] [--depth N] [--meshes N] [--lights N] [--cameras N] [--detail N] [--seed N]\n"
+			"Writes <path/to/output>.scene and <path/to/output>.pnct with:\n"
+			" N transforms with meshes (default " << transforms << "), in chains of 'depth' parent-child transforms (default " << depth << ");\n"
+			" N unique meshes -- boxes and spheres with 'detail' segments (default " << meshes << ", " << detail << ");\n"
+			" N lights (default " << lights << ") and N cameras (default " << cameras << "), each on a transform of its own." << std::endl;
+		return 1;
+	}
+
+	Random random(seed);
+
+	//------------ meshes --------------
+	{
+		std::vector< Vertex > vertices;
+		std::vector< char > strings;
+		std::vector< IndexEntry > index;
+		for (uint32_t m = 0; m < meshes; ++m) {
+			IndexEntry entry;
+			std::tie(entry.name_begin, entry.name_end) = add_name(&strings, "Mesh." + std::to_string(m));
+			entry.vertex_begin = uint32_t(vertices.size());
+			if (m % 2 == 0) {
+				glm::vec3 radius{random(0.2f, 0.5f), random(0.2f, 0.5f), random(0.2f, 0.5f)};
+				make_box(radius, random.color(), &vertices);
+			} else {
+				float radius = random(0.2f, 0.5f);
+				make_sphere(radius, detail + (m / 2) % detail, random.color(), &vertices);
+			}
+			entry.vertex_end = uint32_t(vertices.size());
+			index.emplace_back(entry);
+		}
+
+		std::ofstream out(output + ".pnct", std::ios::binary);
+		write_chunk("pnct", vertices, &out);
+		write_chunk("str0", strings, &out);
+		write_chunk("idx0", index, &out);
+		if (!out) {
+			std::cerr << "Failed to write '" << output << ".pnct'." << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote " << meshes << " meshes (" << vertices.size() / 3 << " triangles) to '" << output << ".pnct'." << std::endl;
+	}
+
+	//------------ scene --------------
+	{
+		std::vector< char > strings;
+		std::vector< HierarchyEntry > hierarchy;
+		std::vector< MeshEntry > mesh_entries;
+		std::vector< CameraEntry > camera_entries;
+		std::vector< LightEntry > light_entries;
+
+		hierarchy.reserve(size_t(transforms) + lights + cameras);
+		mesh_entries.reserve(transforms);
+
+		//chains of transforms start at roots spread through a cube sized to keep the number of objects per unit volume the same:
+		uint32_t roots = (transforms + depth - 1) / depth;
+		float extent = 2.0f * std::cbrt(float(roots));
+
+		auto add_transform = [&](uint32_t parent, std::string const &name, glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale) {
+			HierarchyEntry entry;
+			entry.parent = parent;
+			std::tie(entry.name_begin, entry.name_end) = add_name(&strings, name);
+			entry.position = position;
+			entry.rotation = rotation;
+			entry.scale = scale;
+			hierarchy.emplace_back(entry);
+			return uint32_t(hierarchy.size() - 1);
+		};
+
+		for (uint32_t t = 0; t < transforms; ++t) {
+			uint32_t level = t % depth;
+			uint32_t index;
+			if (level == 0) {
+				glm::vec3 position{random(-extent, extent), random(-extent, extent), random(-extent, extent)};
+				index = add_transform(-1U, "Object." + std::to_string(t), position, random.rotation(), glm::vec3(1.0f));
+			} else {
+				//children sit near (and are a little smaller than) their parent, which is the previous transform:
+				glm::vec3 position{random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(-1.0f, 1.0f)};
+				index = add_transform(uint32_t(hierarchy.size() - 1), "Object." + std::to_string(t), position, random.rotation(), glm::vec3(0.9f));
+			}
+
+			MeshEntry mesh;
+			mesh.transform = index;
+			//(mesh names are added once per use, like the exporter does)
+			std::tie(mesh.name_begin, mesh.name_end) = add_name(&strings, "Mesh." + std::to_string(uint32_t(random.mt() % meshes)));
+			mesh_entries.emplace_back(mesh);
+		}
+
+		for (uint32_t l = 0; l < lights; ++l) {
+			LightEntry light;
+			//one hemisphere light for ambient, then point and spot lights with limited range (so each reaches only some objects):
+			light.type = (l == 0 ? 'h' : (l % 4 == 0 ? 's' : 'p'));
+			glm::vec3 position{random(-extent, extent), random(-extent, extent), random(-extent, extent)};
+			glm::quat rotation = (light.type == 'h' ? glm::quat(1.0f, 0.0f, 0.0f, 0.0f) : random.rotation());
+			light.transform = add_transform(-1U, "Light." + std::to_string(l), position, rotation, glm::vec3(1.0f));
+			glm::u8vec4 color = random.color();
+			light.color = glm::u8vec3(color);
+			light.energy = (light.type == 'h' ? 0.3f : 10.0f);
+			light.distance = (light.type == 'h' ? 0.0f : random(0.25f, 0.5f) * extent);
+			light.fov = (light.type == 's' ? 45.0f : 0.0f);
+			light_entries.emplace_back(light);
+		}
+
+		for (uint32_t c = 0; c < cameras; ++c) {
+			//cameras look at the middle of the scene from outside it:
+			float angle = 6.2831853f * float(c) / float(cameras);
+			glm::vec3 position = 2.0f * extent * glm::vec3(std::cos(angle), std::sin(angle), 0.5f);
+			//(cameras look along their local -z, with local +y up)
+			glm::vec3 back = glm::normalize(position);
+			glm::vec3 right = glm::normalize(glm::cross(glm::vec3(0.0f, 0.0f, 1.0f), back));
+			glm::vec3 up = glm::cross(back, right);
+			glm::quat rotation = glm::quat_cast(glm::mat3(right, up, back));
+			CameraEntry camera;
+			camera.transform = add_transform(-1U, "Camera." + std::to_string(c), position, rotation, glm::vec3(1.0f));
+			camera.type[0] = 'p'; camera.type[1] = 'e'; camera.type[2] = 'r'; camera.type[3] = 's';
+			camera.data = 60.0f;
+			camera.clip_near = 0.1f;
+			camera.clip_far = 10.0f * extent;
+			camera_entries.emplace_back(camera);
+		}
+
+		std::ofstream out(output + ".scene", std::ios::binary);
+		write_chunk("str0", strings, &out);
+		write_chunk("xfh0", hierarchy, &out);
+		write_chunk("msh0", mesh_entries, &out);
+		write_chunk("cam0", camera_entries, &out);
+		write_chunk("lmp0", light_entries, &out);
+		if (!out) {
+			std::cerr << "Failed to write '" << output << ".scene'." << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote " << hierarchy.size() << " transforms (" << mesh_entries.size() << " with meshes, " << light_entries.size() << " lights, " << camera_entries.size() << " cameras) to '" << output << ".scene'." << std::endl;
+	}
+
+	return 0;
+}
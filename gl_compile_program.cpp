@@ -1,9 +1,81 @@
 #include "gl_compile_program.hpp"
 
+#include "HashedName.hpp"
+#include "read_write_chunk.hpp"
+
+#include <SDL.h>
+
 #include <vector>
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+
+//ARB_get_program_binary (core in OpenGL 4.1, so not part of GL.hpp):
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace {
+	//Driver-specific program binaries, stored in files in 'directory':
+	struct ProgramCache {
+		std::string directory;
+
+		typedef void (APIENTRY *GetProgramBinaryFn)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+		typedef void (APIENTRY *ProgramBinaryFn)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+		typedef void (APIENTRY *ProgramParameteriFn)(GLuint program, GLenum pname, GLint value);
+		GetProgramBinaryFn GetProgramBinary = nullptr;
+		ProgramBinaryFn ProgramBinary = nullptr;
+		ProgramParameteriFn ProgramParameteri = nullptr;
+
+		std::string driver; //vendor, renderer, and version (binaries are only valid for the driver that made them)
+		bool checked = false; //have entry points been looked up yet?
+
+		//can binaries be saved and loaded? (must be called with a current context)
+		bool available() {
+			if (directory.empty()) return false;
+			if (!checked) {
+				checked = true;
+				GLint formats = 0;
+				if (SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) {
+					GetProgramBinary = (GetProgramBinaryFn)SDL_GL_GetProcAddress("glGetProgramBinary");
+					ProgramBinary = (ProgramBinaryFn)SDL_GL_GetProcAddress("glProgramBinary");
+					ProgramParameteri = (ProgramParameteriFn)SDL_GL_GetProcAddress("glProgramParameteri");
+					glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+				}
+				if (!(GetProgramBinary && ProgramBinary && ProgramParameteri && formats > 0)) {
+					GetProgramBinary = nullptr;
+					ProgramBinary = nullptr;
+					ProgramParameteri = nullptr;
+				}
+				for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+					GLubyte const *str = glGetString(name);
+					driver += (str ? reinterpret_cast< char const * >(str) : "") + std::string("\n");
+				}
+			}
+			return GetProgramBinary != nullptr;
+		}
+
+		//name of the file that holds the binary for a given program:
+		std::string path(std::string const &vertex_shader_source, std::string const &fragment_shader_source) const {
+			std::string key = driver + '\0' + vertex_shader_source + '\0' + fragment_shader_source;
+			uint64_t hash = hash_name(key.c_str(), key.size());
+			char hex[17];
+			for (uint32_t i = 0; i < 16; ++i) {
+				hex[i] = "0123456789abcdef"[(hash >> (60 - 4 * i)) & 0xf];
+			}
+			hex[16] = '\0';
+			return directory + "program-" + hex + ".bin";
+		}
+	};
+	ProgramCache program_cache;
+}
+
+void gl_set_program_cache_directory(std::string const &directory) {
+	program_cache.directory = directory;
+}
 
 static GLuint gl_compile_shader(GLenum type, std::string const &source) {
 	GLuint shader = glCreateShader(type);
@@ -27,11 +99,54 @@ static GLuint gl_compile_shader(GLenum type, std::string const &source) {
 	return shader;
 }
 
+//link status of 'program', printing the info log on failure:
+static bool gl_check_link(GLuint program) {
+	GLint link_status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+	if (link_status != GL_TRUE) {
+		std::cerr << "Failed to link shader program." << std::endl;
+		GLint info_log_length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
+		std::vector< GLchar > info_log(info_log_length, 0);
+		GLsizei length = 0;
+		glGetProgramInfoLog(program, GLint(info_log.size()), &length, &info_log[0]);
+		std::cerr << "Info log: " << std::string(info_log.begin(), info_log.begin() + length);
+		return false;
+	}
+	return true;
+}
+
 GLuint gl_compile_program(
 	std::string const &vertex_shader_source,
 	std::string const &fragment_shader_source
 	) {
 
+	//try the cached binary first:
+	std::string cache_path;
+	if (program_cache.available()) {
+		cache_path = program_cache.path(vertex_shader_source, fragment_shader_source);
+		std::ifstream file(cache_path, std::ios::binary);
+		if (file) {
+			try {
+				std::vector< GLenum > format;
+				std::vector< char > binary;
+				read_chunk(file, "fmt0", &format);
+				read_chunk(file, "bin0", &binary);
+				if (format.size() == 1 && !binary.empty()) {
+					GLuint program = glCreateProgram();
+					program_cache.ProgramBinary(program, format[0], binary.data(), GLsizei(binary.size()));
+					GLint link_status = GL_FALSE;
+					glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+					if (link_status == GL_TRUE) return program;
+					//(drivers may reject binaries, e.g., after updates; just rebuild it)
+					glDeleteProgram(program);
+				}
+			} catch (std::runtime_error &) {
+				//(corrupt or truncated file; rebuild it)
+			}
+		}
+	}
+
 	GLuint vertex_shader = gl_compile_shader(GL_VERTEX_SHADER, vertex_shader_source);
 	GLuint fragment_shader = gl_compile_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
 
@@ -39,24 +154,68 @@ GLuint gl_compile_program(
 	glAttachShader(program, vertex_shader);
 	glAttachShader(program, fragment_shader);
 
+	//(programs that will be cached need to be marked before linking)
+	if (!cache_path.empty()) {
+		program_cache.ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
 	//shaders are reference counted so this makes sure they are freed after program is deleted:
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
 
 	//link the shader program and throw errors if linking fails:
 	glLinkProgram(program);
-	GLint link_status = GL_FALSE;
-	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
-	if (link_status != GL_TRUE) {
-		std::cerr << "Failed to link shader program." << std::endl;
-		GLint info_log_length = 0;
-		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
-		std::vector< GLchar > info_log(info_log_length, 0);
-		GLsizei length = 0;
-		glGetProgramInfoLog(program, GLint(info_log.size()), &length, &info_log[0]);
-		std::cerr << "Info log: " << std::string(info_log.begin(), info_log.begin() + length);
+	if (!gl_check_link(program)) {
 		throw std::runtime_error("failed to link program");
 	}
 
+	//save the binary for next time:
+	if (!cache_path.empty()) {
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		std::vector< GLenum > format(1, 0);
+		std::vector< char > binary(length);
+		GLsizei written = 0;
+		if (length > 0) program_cache.GetProgramBinary(program, length, &written, &format[0], binary.data());
+		binary.resize(written);
+		if (!binary.empty()) {
+			std::ofstream file(cache_path, std::ios::binary);
+			write_chunk("fmt0", format, &file);
+			write_chunk("bin0", binary, &file);
+			if (!file) {
+				std::cerr << "NOTE: failed to write program cache file '" << cache_path << "'." << std::endl;
+			}
+		}
+	}
+
 	return program;
 }
+
+GLuint gl_compile_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source,
+	std::vector< std::string > const &defines) {
+
+	std::string lines;
+	for (auto const &define : defines) {
+		lines += "#define " + define + "\n";
+	}
+
+	//'#version' must come first, so add defines after it:
+	auto specialize = [&lines](std::string const &source) {
+		std::string::size_type after = 0;
+		if (source.compare(0, 8, "#version") == 0) {
+			after = source.find('\n');
+			after = (after == std::string::npos ? source.size() : after + 1);
+		}
+		return source.substr(0, after) + lines + source.substr(after);
+	};
+
+	return gl_compile_program(specialize(vertex_shader_source), specialize(fragment_shader_source));
+}
+
+void gl_bind_uniform_block(GLuint program, std::string const &block_name, GLuint binding) {
+	GLuint index = glGetUniformBlockIndex(program, block_name.c_str());
+	if (index == GL_INVALID_INDEX) return;
+	glUniformBlockBinding(program, index, binding);
+}
@@ -3,9 +3,27 @@
 #include "GL.hpp"
 
 #include <string>
+#include <vector>
 
 //compiles+links an OpenGL shader program from source.
 // throws on compilation error.
 GLuint gl_compile_program(
 	std::string const &vertex_shader_source,
 	std::string const &fragment_shader_source);
+
+//compiles+links a specialized variant of a program:
+// each entry of 'defines' ("NAME" or "NAME VALUE") becomes a '#define' line after the '#version' line of both shaders.
+GLuint gl_compile_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source,
+	std::vector< std::string > const &defines);
+
+//programs linked by gl_compile_program() are saved in (and, on later runs, loaded from) this directory,
+// if the driver supports ARB_get_program_binary:
+// (cache files are named by a hash of the program's sources and the driver's vendor/renderer/version strings)
+// (empty -- the default -- disables the cache; non-empty directories must end with a path separator)
+void gl_set_program_cache_directory(std::string const &directory);
+
+//connects the uniform block named 'block_name' in 'program' to uniform buffer binding point 'binding':
+// (does nothing if the program has no active block with that name)
+void gl_bind_uniform_block(GLuint program, std::string const &block_name, GLuint binding);
@@ -0,0 +1,415 @@
+//Converts a '.pnct' mesh file of triangle soup into an indexed one (read by MeshBuffer):
+// identical vertices are welded together, and each mesh's triangles are reordered so that
+// the GPU's post-transform vertex cache gets reused often (fewer vertex shader runs), then
+// -- within that order -- so that outward-facing parts draw first (less overdraw).
+//Usage: index-meshes <in.pnct> <out.pnct> (in and out may be the same file)
+
+#include "ChunkFile.hpp"
+#include "read_write_chunk.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//------------ file contents (must match MeshBuffer::MeshBuffer) --------------
+
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end; //(in indexed files, a range of indices)
+};
+static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+
+//------------ vertex cache model --------------
+
+//misses (i.e., vertex shader runs) when drawing 'triangles' through a FIFO cache of 'size' vertices:
+// (a simple model of real post-transform caches, used to measure and to find cluster boundaries)
+struct FIFOCache {
+	FIFOCache(uint32_t size_) : size(size_) { }
+	uint32_t size;
+	std::vector< uint32_t > entries;
+	std::unordered_map< uint32_t, uint32_t > stamps; //vertex => time it entered the cache
+	uint32_t time = 0;
+
+	void clear() {
+		stamps.clear();
+		time = 0;
+	}
+	//returns number of misses for this triangle:
+	uint32_t triangle(uint32_t const *tri) {
+		uint32_t misses = 0;
+		for (uint32_t i = 0; i < 3; ++i) {
+			auto f = stamps.find(tri[i]);
+			if (f == stamps.end() || time - f->second >= size) {
+				stamps[tri[i]] = time++;
+				misses += 1;
+			}
+		}
+		return misses;
+	}
+};
+
+float acmr(std::vector< uint32_t > const &indices, uint32_t cache_size = 16) {
+	if (indices.empty()) return 0.0f;
+	FIFOCache cache(cache_size);
+	uint32_t misses = 0;
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		misses += cache.triangle(&indices[t]);
+	}
+	return float(misses) / float(indices.size() / 3);
+}
+
+//------------ vertex cache optimization --------------
+//After Tom Forsyth's "Linear-Speed Vertex Cache Optimisation":
+// greedily emit the triangle whose vertices score best, where vertices score higher
+// when they were used recently (so are likely still in the cache) and when few
+// triangles still use them (so they can be finished off and forgotten).
+
+void optimize_vertex_cache(std::vector< uint32_t > *indices_, uint32_t vertex_count) {
+	std::vector< uint32_t > &indices = *indices_;
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+	if (triangle_count == 0) return;
+
+	constexpr int32_t CacheSize = 32;
+	auto vertex_score = [](int32_t cache_position, uint32_t remaining) -> float {
+		if (remaining == 0) return -1.0f;
+		float score = 0.0f;
+		if (cache_position >= 0) {
+			if (cache_position < 3) {
+				score = 0.75f; //(the last triangle's vertices: fixed score, so it doesn't matter which order they went in)
+			} else {
+				score = std::pow(1.0f - float(cache_position - 3) / float(CacheSize - 3), 1.5f);
+			}
+		}
+		return score + 2.0f / std::sqrt(float(remaining));
+	};
+
+	//triangles using each vertex (packed; 'remaining' of them still to be emitted, at the front of each list):
+	std::vector< uint32_t > remaining(vertex_count, 0);
+	for (uint32_t i : indices) remaining[i] += 1;
+	std::vector< uint32_t > first(vertex_count + 1, 0);
+	for (uint32_t v = 0; v < vertex_count; ++v) first[v+1] = first[v] + remaining[v];
+	std::vector< uint32_t > adjacent(indices.size());
+	{
+		std::vector< uint32_t > filled(vertex_count, 0);
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			for (uint32_t i = 0; i < 3; ++i) {
+				uint32_t v = indices[3*t+i];
+				adjacent[first[v] + filled[v]++] = t;
+			}
+		}
+	}
+
+	std::vector< int32_t > cache_position(vertex_count, -1);
+	std::vector< float > score(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v) score[v] = vertex_score(-1, remaining[v]);
+	std::vector< float > triangle_score(triangle_count);
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		triangle_score[t] = score[indices[3*t+0]] + score[indices[3*t+1]] + score[indices[3*t+2]];
+	}
+	std::vector< bool > emitted(triangle_count, false);
+
+	std::vector< uint32_t > cache;
+	std::vector< uint32_t > result;
+	result.reserve(indices.size());
+	uint32_t scan = 0; //(for finding an unemitted triangle when the cache has nothing useful)
+
+	uint32_t best = 0;
+	for (uint32_t t = 1; t < triangle_count; ++t) {
+		if (triangle_score[t] > triangle_score[best]) best = t;
+	}
+
+	while (true) {
+		//emit 'best':
+		emitted[best] = true;
+		uint32_t const *tri = &indices[3*best];
+		result.insert(result.end(), tri, tri + 3);
+
+		//put its vertices at the front of the cache, and forget the triangle:
+		std::vector< uint32_t > next_cache(tri, tri + 3);
+		for (uint32_t i = 0; i < 3; ++i) {
+			uint32_t v = tri[i];
+			uint32_t *list = &adjacent[first[v]];
+			uint32_t *found = std::find(list, list + remaining[v], best);
+			std::swap(*found, list[remaining[v] - 1]);
+			remaining[v] -= 1;
+		}
+		for (uint32_t v : cache) {
+			if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.emplace_back(v);
+		}
+
+		//update scores of everything that was or is in the cache:
+		for (uint32_t p = 0; p < next_cache.size(); ++p) {
+			uint32_t v = next_cache[p];
+			cache_position[v] = (p < uint32_t(CacheSize) ? int32_t(p) : -1);
+			score[v] = vertex_score(cache_position[v], remaining[v]);
+		}
+		if (next_cache.size() > size_t(CacheSize)) next_cache.resize(CacheSize);
+		cache = std::move(next_cache);
+
+		//...and of the triangles using those vertices, picking the best one to emit next:
+		float best_score = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t const *t = &adjacent[first[v]]; t != &adjacent[first[v]] + remaining[v]; ++t) {
+				triangle_score[*t] = score[indices[3 * *t + 0]] + score[indices[3 * *t + 1]] + score[indices[3 * *t + 2]];
+				if (triangle_score[*t] > best_score) {
+					best_score = triangle_score[*t];
+					best = *t;
+				}
+			}
+		}
+
+		if (best_score < 0.0f) {
+			//nothing in the cache is still needed, so start somewhere new:
+			while (scan < triangle_count && emitted[scan]) ++scan;
+			if (scan == triangle_count) break;
+			best = scan;
+		}
+	}
+
+	indices = std::move(result);
+}
+
+//------------ overdraw optimization --------------
+//After Sander, Nehab, and Barczak's "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw":
+// split the cache-optimized order into clusters (at places where the cache starts over anyway,
+// or where starting over costs little), then draw clusters that face away from the mesh's
+// center first, since they are likely in front of the others.
+
+void optimize_overdraw(std::vector< uint32_t > *indices_, std::vector< Vertex > const &vertices, float threshold) {
+	std::vector< uint32_t > &indices = *indices_;
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+	if (triangle_count < 2) return;
+
+	constexpr uint32_t CacheSize = 16;
+
+	//hard boundaries -- triangles where every vertex misses the cache:
+	std::vector< uint32_t > hard;
+	{
+		FIFOCache cache(CacheSize);
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (cache.triangle(&indices[3*t]) == 3) hard.emplace_back(t);
+		}
+		hard.emplace_back(triangle_count);
+	}
+
+	//soft boundaries -- within each hard cluster, split wherever the cluster so far is nearly as cache-friendly as the whole:
+	std::vector< uint32_t > clusters; //(first triangle of each cluster)
+	{
+		FIFOCache cache(CacheSize);
+		for (size_t h = 0; h + 1 < hard.size(); ++h) {
+			uint32_t begin = hard[h], end = hard[h+1];
+
+			cache.clear();
+			uint32_t misses = 0;
+			for (uint32_t t = begin; t < end; ++t) misses += cache.triangle(&indices[3*t]);
+			float limit = threshold * float(misses) / float(end - begin);
+
+			clusters.emplace_back(begin);
+			cache.clear();
+			uint32_t cluster_begin = begin;
+			uint32_t cluster_misses = 0;
+			for (uint32_t t = begin; t < end; ++t) {
+				cluster_misses += cache.triangle(&indices[3*t]);
+				if (t + 1 < end && float(cluster_misses) / float(t + 1 - cluster_begin) <= limit) {
+					clusters.emplace_back(t + 1);
+					cluster_begin = t + 1;
+					cluster_misses = 0;
+					cache.clear();
+				}
+			}
+		}
+	}
+	clusters.emplace_back(triangle_count);
+
+	//mesh center (area-weighted):
+	auto triangle_area_center = [&](uint32_t t, glm::vec3 *area_normal) {
+		glm::vec3 a = vertices[indices[3*t+0]].Position;
+		glm::vec3 b = vertices[indices[3*t+1]].Position;
+		glm::vec3 c = vertices[indices[3*t+2]].Position;
+		*area_normal = 0.5f * glm::cross(b - a, c - a);
+		return (a + b + c) / 3.0f;
+	};
+	glm::vec3 center = glm::vec3(0.0f);
+	float total_area = 0.0f;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		glm::vec3 area_normal;
+		glm::vec3 c = triangle_area_center(t, &area_normal);
+		float area = glm::length(area_normal);
+		center += area * c;
+		total_area += area;
+	}
+	if (total_area > 0.0f) center /= total_area;
+
+	//sort clusters by how much they face away from the center:
+	struct Cluster {
+		uint32_t begin, end;
+		float outward;
+	};
+	std::vector< Cluster > sorted;
+	for (size_t i = 0; i + 1 < clusters.size(); ++i) {
+		Cluster cluster{ clusters[i], clusters[i+1], 0.0f };
+		glm::vec3 normal = glm::vec3(0.0f);
+		glm::vec3 cluster_center = glm::vec3(0.0f);
+		float area = 0.0f;
+		for (uint32_t t = cluster.begin; t < cluster.end; ++t) {
+			glm::vec3 area_normal;
+			glm::vec3 c = triangle_area_center(t, &area_normal);
+			normal += area_normal;
+			cluster_center += glm::length(area_normal) * c;
+			area += glm::length(area_normal);
+		}
+		if (area > 0.0f && glm::length(normal) > 0.0f) {
+			cluster.outward = glm::dot(cluster_center / area - center, glm::normalize(normal));
+		}
+		sorted.emplace_back(cluster);
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](Cluster const &a, Cluster const &b) {
+		return a.outward > b.outward;
+	});
+
+	std::vector< uint32_t > result;
+	result.reserve(indices.size());
+	for (auto const &cluster : sorted) {
+		result.insert(result.end(), indices.begin() + 3 * cluster.begin, indices.begin() + 3 * cluster.end);
+	}
+	indices = std::move(result);
+}
+
+//------------ main --------------
+
+int main(int argc, char **argv) {
+	std::string input, output;
+	float threshold = 1.05f;
+
+	bool usage = false;
+	for (int a = 1; a < argc; ++a) {
+		std::string arg = argv[a];
+		if (arg == "--overdraw-threshold" && a + 1 < argc) threshold = float(std::atof(argv[++a]));
+		else if (arg.substr(0, 2) != "--" && input.empty()) input = arg;
+		else if (arg.substr(0, 2) != "--" && output.empty()) output = arg;
+		else usage = true;
+	}
+	if (input.empty() || output.empty()) usage = true;
+	if (usage) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct> [--overdraw-threshold T]\n"
+			"Welds identical vertices, reorders triangles for vertex cache reuse and less overdraw, and writes an indexed mesh file.\n"
+			" --overdraw-threshold: how much worse (as a multiple) vertex cache use may get to allow reordering for overdraw\n"
+			"   (default " << threshold << "; 0 keeps the vertex cache order)." << std::endl;
+		return 1;
+	}
+
+	//------------ read --------------
+	std::vector< Vertex > soup;
+	std::vector< char > strings;
+	std::vector< IndexEntry > index;
+	{ //(the file is closed before writing, since input and output may be the same)
+		ChunkFile file(input);
+		ChunkSpan< Vertex > vertices = file.read< Vertex >("pnct");
+		if (file.next_is("ix16") || file.next_is("ix32")) {
+			throw std::runtime_error("'" + input + "' is already indexed.");
+		}
+		ChunkSpan< char > names = file.read< char >("str0");
+		ChunkSpan< IndexEntry > entries = file.read< IndexEntry >("idx0");
+		soup.assign(vertices.begin(), vertices.end());
+		strings.assign(names.begin(), names.end());
+		index.assign(entries.begin(), entries.end());
+	}
+
+	//------------ weld + reorder, mesh by mesh --------------
+	//(so each mesh's vertices stay together in the buffer)
+	std::vector< Vertex > vertices;
+	std::vector< uint32_t > indices;
+	for (auto &entry : index) {
+		if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= soup.size())) {
+			throw std::runtime_error("index entry has out-of-range vertex start/count");
+		}
+		if ((entry.vertex_end - entry.vertex_begin) % 3 != 0) {
+			throw std::runtime_error("mesh '" + std::string(strings.begin() + entry.name_begin, strings.begin() + entry.name_end) + "' isn't made of triangles.");
+		}
+
+		//weld vertices that are exactly the same (every byte):
+		struct Hash {
+			size_t operator()(Vertex const &v) const {
+				uint64_t hash = 0xcbf29ce484222325ULL;
+				uint8_t const *bytes = reinterpret_cast< uint8_t const * >(&v);
+				for (size_t i = 0; i < sizeof(Vertex); ++i) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+				return size_t(hash);
+			}
+		};
+		struct Equal {
+			bool operator()(Vertex const &a, Vertex const &b) const { return std::memcmp(&a, &b, sizeof(Vertex)) == 0; }
+		};
+		std::unordered_map< Vertex, uint32_t, Hash, Equal > welded;
+		std::vector< Vertex > mesh_vertices;
+		std::vector< uint32_t > mesh_indices;
+		for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+			auto ret = welded.emplace(soup[v], uint32_t(mesh_vertices.size()));
+			if (ret.second) mesh_vertices.emplace_back(soup[v]);
+			mesh_indices.emplace_back(ret.first->second);
+		}
+
+		optimize_vertex_cache(&mesh_indices, uint32_t(mesh_vertices.size()));
+		if (threshold > 0.0f) optimize_overdraw(&mesh_indices, mesh_vertices, threshold);
+
+		//store vertices in the order they are first used (so fetching them walks through memory):
+		std::vector< uint32_t > remap(mesh_vertices.size(), -1U);
+		uint32_t base = uint32_t(vertices.size());
+		entry.vertex_begin = uint32_t(indices.size());
+		for (uint32_t i : mesh_indices) {
+			if (remap[i] == -1U) {
+				remap[i] = uint32_t(vertices.size()) - base;
+				vertices.emplace_back(mesh_vertices[i]);
+			}
+			indices.emplace_back(base + remap[i]);
+		}
+		entry.vertex_end = uint32_t(indices.size());
+	}
+
+	//------------ write --------------
+	std::ofstream out(output, std::ios::binary);
+	write_chunk("pnct", vertices, &out);
+	size_t index_bytes;
+	if (vertices.size() <= 0x10000) {
+		std::vector< uint16_t > short_indices(indices.begin(), indices.end());
+		write_chunk("ix16", short_indices, &out);
+		index_bytes = short_indices.size() * sizeof(uint16_t);
+	} else {
+		write_chunk("ix32", indices, &out);
+		index_bytes = indices.size() * sizeof(uint32_t);
+	}
+	write_chunk("str0", strings, &out);
+	write_chunk("idx0", index, &out);
+	if (!out) {
+		throw std::runtime_error("Failed to write '" + output + "'.");
+	}
+
+	size_t before = soup.size() * sizeof(Vertex);
+	size_t after = vertices.size() * sizeof(Vertex) + index_bytes;
+	std::cout << "Wrote '" << output << "': " << index.size() << " meshes; "
+		<< soup.size() << " vertices => " << vertices.size() << " vertices + " << indices.size() << " indices; "
+		<< before << " bytes => " << after << " bytes (" << (after ? float(before) / float(after) : 0.0f) << "x smaller); "
+		<< "vertex shader runs per triangle (16-entry FIFO cache): 3 => " << acmr(indices) << "." << std::endl;
+	if (after >= before) {
+		std::cout << "NOTE: few vertices were shared (flat-shaded meshes have different normals at every corner), so the unindexed file is smaller." << std::endl;
+	}
+
+	return 0;
+}
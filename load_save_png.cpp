@@ -1,10 +1,14 @@
 #include "load_save_png.hpp"
 
 #include <png.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstdlib>
+#include <thread>
 #include <vector>
 
 #define LOG_ERROR( X ) std::cerr << X << std::endl
@@ -173,3 +177,244 @@ void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8
 
 	return;
 }
+
+
+//------------------------------------------------------------------
+//Striped (multithreaded) PNG writing, using zlib directly.
+//
+//Each stripe of rows is filtered and deflated independently, ending with a
+// full flush (which byte-aligns the output and doesn't let later data refer back
+// to it), so the compressed stripes can just be concatenated into one zlib stream.
+// The stream's checksum is stitched together from per-stripe checksums.
+
+namespace {
+	struct PNGStripe {
+		uint32_t begin = 0, end = 0; //rows [begin,end), numbered top-to-bottom
+		std::vector< uint8_t > compressed;
+		uLong adler = 1; //of this stripe's filtered (uncompressed) bytes
+		uLong filtered_size = 0;
+		uLong crc = 0; //of 'compressed'
+		bool ok = true;
+	};
+
+	uint8_t paeth(int a, int b, int c) {
+		int p = a + b - c;
+		int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		if (pa <= pb && pa <= pc) return uint8_t(a);
+		if (pb <= pc) return uint8_t(b);
+		return uint8_t(c);
+	}
+
+	//filter one row into 'out' (which starts with the filter type byte); 'up' is the row above (or all zeros):
+	void filter_row(PNGFilter filter, uint8_t const *row, uint8_t const *up, size_t row_bytes, uint8_t *out) {
+		constexpr size_t Bpp = 4; //bytes per pixel
+		out[0] = uint8_t(filter - PNGFilterNone);
+		uint8_t *dst = out + 1;
+		if (filter == PNGFilterNone) {
+			std::copy(row, row + row_bytes, dst);
+		} else if (filter == PNGFilterSub) {
+			for (size_t i = 0; i < row_bytes; ++i) dst[i] = uint8_t(row[i] - (i >= Bpp ? row[i-Bpp] : 0));
+		} else if (filter == PNGFilterUp) {
+			for (size_t i = 0; i < row_bytes; ++i) dst[i] = uint8_t(row[i] - up[i]);
+		} else if (filter == PNGFilterAverage) {
+			for (size_t i = 0; i < row_bytes; ++i) dst[i] = uint8_t(row[i] - ((i >= Bpp ? row[i-Bpp] : 0) + up[i]) / 2);
+		} else if (filter == PNGFilterPaeth) {
+			for (size_t i = 0; i < row_bytes; ++i) {
+				dst[i] = uint8_t(row[i] - (i >= Bpp ? paeth(row[i-Bpp], up[i], up[i-Bpp]) : paeth(0, up[i], 0)));
+			}
+		} else {
+			assert(0 && "filter_row only handles single filters");
+		}
+	}
+
+	//the usual heuristic: the row whose filtered bytes (as signed values) are closest to zero compresses best:
+	uint64_t filter_cost(uint8_t const *filtered, size_t row_bytes) {
+		uint64_t cost = 0;
+		for (size_t i = 0; i < row_bytes; ++i) {
+			cost += uint64_t(std::abs(int(int8_t(filtered[i]))));
+		}
+		return cost;
+	}
+
+	void compress_stripe(PNGStripe *stripe, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options, bool last) {
+		size_t row_bytes = size_t(size.x) * 4;
+		auto get_row = [&](uint32_t y) -> uint8_t const * {
+			if (origin == LowerLeftOrigin) y = size.y - 1 - y;
+			return reinterpret_cast< uint8_t const * >(data + size_t(y) * size.x);
+		};
+		std::vector< uint8_t > zeros(row_bytes, 0);
+
+		//filter:
+		std::vector< uint8_t > filtered((stripe->end - stripe->begin) * (1 + row_bytes));
+		std::vector< uint8_t > trial(options.filter == PNGFilterAdaptive ? 1 + row_bytes : 0);
+		for (uint32_t y = stripe->begin; y < stripe->end; ++y) {
+			uint8_t const *row = get_row(y);
+			uint8_t const *up = (y > 0 ? get_row(y-1) : zeros.data());
+			uint8_t *out = &filtered[(y - stripe->begin) * (1 + row_bytes)];
+			if (options.filter == PNGFilterAdaptive) {
+				uint64_t best = -1ULL;
+				for (PNGFilter f : {PNGFilterNone, PNGFilterSub, PNGFilterUp, PNGFilterAverage, PNGFilterPaeth}) {
+					filter_row(f, row, up, row_bytes, trial.data());
+					uint64_t cost = filter_cost(trial.data() + 1, row_bytes);
+					if (cost < best) {
+						best = cost;
+						std::copy(trial.begin(), trial.end(), out);
+					}
+				}
+			} else {
+				filter_row(options.filter, row, up, row_bytes, out);
+			}
+		}
+		stripe->filtered_size = uLong(filtered.size());
+		stripe->adler = adler32(1, filtered.data(), uInt(filtered.size()));
+
+		//deflate (raw, since the zlib header and checksum are written around the stitched stripes):
+		z_stream strm;
+		strm.zalloc = Z_NULL;
+		strm.zfree = Z_NULL;
+		strm.opaque = Z_NULL;
+		if (deflateInit2(&strm, std::clamp(options.level, 0, 9), Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			stripe->ok = false;
+			return;
+		}
+		strm.next_in = filtered.data();
+		strm.avail_in = uInt(filtered.size());
+		stripe->compressed.resize(deflateBound(&strm, uLong(filtered.size())) + 16); //(+16 for the flush marker)
+		strm.next_out = stripe->compressed.data();
+		strm.avail_out = uInt(stripe->compressed.size());
+		int flush = (last ? Z_FINISH : Z_FULL_FLUSH);
+		while (true) {
+			int ret = deflate(&strm, flush);
+			if (ret == Z_STREAM_ERROR) {
+				stripe->ok = false;
+				break;
+			}
+			if (last ? ret == Z_STREAM_END : (strm.avail_in == 0 && strm.avail_out != 0)) break;
+			//(out of room -- shouldn't happen, given deflateBound, but just in case)
+			size_t used = stripe->compressed.size() - strm.avail_out;
+			stripe->compressed.resize(stripe->compressed.size() * 2);
+			strm.next_out = stripe->compressed.data() + used;
+			strm.avail_out = uInt(stripe->compressed.size() - used);
+		}
+		stripe->compressed.resize(stripe->compressed.size() - strm.avail_out);
+		deflateEnd(&strm);
+
+		stripe->crc = crc32(0, stripe->compressed.data(), uInt(stripe->compressed.size()));
+	}
+
+	void put_u32(std::vector< uint8_t > *to, uint32_t val) {
+		to->emplace_back(uint8_t(val >> 24));
+		to->emplace_back(uint8_t(val >> 16));
+		to->emplace_back(uint8_t(val >> 8));
+		to->emplace_back(uint8_t(val));
+	}
+
+	//write a chunk whose data is 'head' followed by 'parts' (with 'parts_crc' already computed over them):
+	void write_chunk(std::ostream &to, char const (&type)[5], std::vector< uint8_t > const &head, std::vector< std::vector< uint8_t > const * > const &parts = {}, uLong parts_crc = 0, uLong parts_size = 0) {
+		std::vector< uint8_t > prefix;
+		put_u32(&prefix, uint32_t(head.size() + parts_size));
+		prefix.insert(prefix.end(), type, type + 4);
+		prefix.insert(prefix.end(), head.begin(), head.end());
+		uLong crc = crc32(0, prefix.data() + 4, uInt(prefix.size() - 4));
+		if (!parts.empty()) crc = crc32_combine(crc, parts_crc, z_off_t(parts_size));
+
+		std::vector< uint8_t > suffix;
+		put_u32(&suffix, uint32_t(crc));
+
+		to.write(reinterpret_cast< char const * >(prefix.data()), prefix.size());
+		for (auto part : parts) {
+			to.write(reinterpret_cast< char const * >(part->data()), part->size());
+		}
+		to.write(reinterpret_cast< char const * >(suffix.data()), suffix.size());
+	}
+}
+
+void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options) {
+	if (size.x == 0 || size.y == 0) {
+		throw std::runtime_error("Can't save an empty image to '" + filename + "'.");
+	}
+	size_t row_bytes = size_t(size.x) * 4;
+
+	//split into stripes -- one per thread, but not so small that flushing costs much compression:
+	uint32_t threads = options.threads;
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	constexpr size_t MinStripeBytes = 128 * 1024;
+	size_t max_stripes = std::max< size_t >(1, (size.y * row_bytes) / MinStripeBytes);
+	uint32_t count = uint32_t(std::min< size_t >({ threads, max_stripes, size.y }));
+
+	std::vector< PNGStripe > stripes(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		stripes[i].begin = uint32_t(uint64_t(size.y) * i / count);
+		stripes[i].end = uint32_t(uint64_t(size.y) * (i + 1) / count);
+	}
+
+	//compress the first stripe on this thread and the rest on helper threads:
+	std::vector< std::thread > helpers;
+	helpers.reserve(count - 1);
+	for (uint32_t i = 1; i < count; ++i) {
+		helpers.emplace_back(compress_stripe, &stripes[i], size, data, origin, std::cref(options), i + 1 == count);
+	}
+	compress_stripe(&stripes[0], size, data, origin, options, count == 1);
+	for (auto &helper : helpers) {
+		helper.join();
+	}
+
+	//stitch the stripes into a single zlib stream:
+	std::vector< uint8_t > zlib_header;
+	{
+		int level = std::clamp(options.level, 0, 9);
+		uint8_t cmf = 0x78; //deflate, 32k window
+		uint8_t flevel = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3);
+		uint8_t flg = uint8_t(flevel << 6);
+		flg += uint8_t(31 - (cmf * 256 + flg) % 31); //(header check bits)
+		zlib_header = { cmf, flg };
+	}
+	std::vector< std::vector< uint8_t > const * > parts;
+	uLong adler = 1;
+	uLong crc = 0;
+	uLong compressed_size = 0;
+	for (auto const &stripe : stripes) {
+		if (!stripe.ok) {
+			throw std::runtime_error("Failed to compress PNG image for '" + filename + "'.");
+		}
+		adler = adler32_combine(adler, stripe.adler, z_off_t(stripe.filtered_size));
+		crc = crc32_combine(crc, stripe.crc, z_off_t(stripe.compressed.size()));
+		compressed_size += uLong(stripe.compressed.size());
+		parts.emplace_back(&stripe.compressed);
+	}
+	std::vector< uint8_t > zlib_trailer;
+	put_u32(&zlib_trailer, uint32_t(adler));
+	crc = crc32_combine(crc, crc32(0, zlib_trailer.data(), uInt(zlib_trailer.size())), z_off_t(zlib_trailer.size()));
+	compressed_size += uLong(zlib_trailer.size());
+	parts.emplace_back(&zlib_trailer);
+
+	if (zlib_header.size() + compressed_size > 0x7fffffff) {
+		throw std::runtime_error("PNG image for '" + filename + "' is too big for one IDAT chunk.");
+	}
+
+	//write the file:
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open PNG image file '" + filename + "' for writing.");
+	}
+	static uint8_t const signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file.write(reinterpret_cast< char const * >(signature), sizeof(signature));
+
+	std::vector< uint8_t > ihdr;
+	put_u32(&ihdr, size.x);
+	put_u32(&ihdr, size.y);
+	ihdr.insert(ihdr.end(), {
+		8, //bit depth
+		6, //color type: RGBA
+		0, //compression method: deflate
+		0, //filter method: adaptive (per-row filter types)
+		0, //no interlacing
+	});
+	write_chunk(file, "IHDR", ihdr);
+	write_chunk(file, "IDAT", zlib_header, parts, crc, compressed_size);
+	write_chunk(file, "IEND", {});
+
+	if (!file) {
+		throw std::runtime_error("Failed to write PNG image to '" + filename + "'.");
+	}
+}
@@ -18,3 +18,25 @@ enum OriginLocation {
 //NOTE: load_png will throw on error
 void load_png(std::string filename, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin);
 void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin);
+
+//Faster saving for big images (e.g., screenshots):
+// splits the image into stripes of rows, which are filtered and compressed on separate threads.
+// (the result is an ordinary PNG; each stripe's compressed data just starts fresh at a byte boundary)
+enum PNGFilter {
+	PNGFilterNone,
+	PNGFilterSub,
+	PNGFilterUp,
+	PNGFilterAverage,
+	PNGFilterPaeth,
+	PNGFilterAdaptive, //pick the filter for each row that seems likely to compress best (slower, smaller files)
+};
+struct PNGSaveOptions {
+	int level = 6; //zlib compression level: 0 (store only) to 9 (smallest)
+	PNGFilter filter = PNGFilterAdaptive;
+	uint32_t threads = 0; //compress with at most this many threads (0 => one per core)
+
+	//store-only: no filtering or compression -- files are big, but writing them costs little more than copying:
+	static PNGSaveOptions fastest() { PNGSaveOptions options; options.level = 0; options.filter = PNGFilterNone; return options; }
+};
+//NOTE: unlike the save_png above, this one will throw on error
+void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options);
@@ -13,17 +13,32 @@
 //GL.hpp will include a non-namespace-polluting set of opengl prototypes:
 #include "GL.hpp"
 
+//for the shader program cache:
+#include "gl_compile_program.hpp"
+
+//for timing:
+#include "Profiler.hpp"
+
 //for screenshots:
-#include "load_save_png.hpp"
+#include "Screenshot.hpp"
+
+//for streaming in textures:
+#include "TextureStream.hpp"
+
+//for the frame timing overlay:
+#include "FrameStats.hpp"
 
 //Includes for libSDL:
 #include <SDL.h>
 
 //...and for c++ standard library functions:
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <thread>
 #include <stdexcept>
 #include <memory>
+#include <mutex>
 #include <algorithm>
 
 int main(int argc, char **argv) {
@@ -32,6 +47,55 @@ int main(int argc, char **argv) {
 	try {
 #endif
 
+	//------------  command line ------------
+	//--trace <file> writes a timeline of everything that happened to <file> at exit:
+	std::string trace_filename;
+	//--fps-limit <N> caps the frame rate at N frames per second (0 = no cap; if vsync isn't available, the display's rate is used):
+	int fps_limit = -1; //(-1 = not given)
+	//--threaded-update updates modes that support it on a separate thread from drawing:
+	bool threaded_update = false;
+	//--capture <prefix> records frames to <prefix>-000000.png, ... (F11 starts/stops recording to 'capture-*.png'):
+	// --capture-every <N> records every Nth frame; --capture-ppm writes .ppm files; --capture-drop drops frames instead of waiting when encoding falls behind
+	// --capture-fps <N> is the game time shown by each frame while recording (default 60)
+	//  (so while recording, updates run on the main thread, in step with frames, even with --threaded-update)
+	// --capture-level <0-9> sets PNG compression (default 1; 0 stores pixels uncompressed, which is fastest)
+	bool capture = false;
+	Screenshot::CaptureSettings capture_settings;
+	float capture_fps = 60.0f;
+	for (int arg = 1; arg < argc; ++arg) {
+		if (std::string(argv[arg]) == "--trace" && arg + 1 < argc) {
+			trace_filename = argv[arg + 1];
+			arg += 1;
+		} else if (std::string(argv[arg]) == "--threaded-update") {
+			threaded_update = true;
+		} else if (std::string(argv[arg]) == "--capture" && arg + 1 < argc) {
+			capture = true;
+			capture_settings.prefix = argv[arg + 1];
+			arg += 1;
+		} else if (std::string(argv[arg]) == "--capture-every" && arg + 1 < argc) {
+			capture_settings.every = uint32_t(std::max(1, std::atoi(argv[arg + 1])));
+			arg += 1;
+		} else if (std::string(argv[arg]) == "--capture-fps" && arg + 1 < argc) {
+			capture_fps = std::max(1.0f, float(std::atof(argv[arg + 1])));
+			arg += 1;
+		} else if (std::string(argv[arg]) == "--capture-level" && arg + 1 < argc) {
+			capture_settings.png.level = std::clamp(std::atoi(argv[arg + 1]), 0, 9);
+			if (capture_settings.png.level == 0) capture_settings.png.filter = PNGFilterNone; //(filtering only helps compression)
+			arg += 1;
+		} else if (std::string(argv[arg]) == "--capture-ppm") {
+			capture_settings.ppm = true;
+		} else if (std::string(argv[arg]) == "--capture-drop") {
+			capture_settings.drop = true;
+		} else if (std::string(argv[arg]) == "--fps-limit" && arg + 1 < argc) {
+			fps_limit = std::max(0, std::atoi(argv[arg + 1]));
+			arg += 1;
+		} else {
+			std::cerr << "Ignoring unrecognized argument '" << argv[arg] << "' (usage: " << argv[0] << " [--trace <file.json>] [--fps-limit <N>] [--threaded-update] [--capture <prefix>] [--capture-every <N>] [--capture-fps <N>] [--capture-level <0-9>] [--capture-ppm] [--capture-drop])." << std::endl;
+		}
+	}
+
+	profiler_set_thread_name("main");
+
 	//------------  initialization ------------
 
 	//Initialize SDL library:
@@ -86,6 +150,16 @@ int main(int argc, char **argv) {
 		std::cerr << "NOTE: couldn't set vsync + late swap tearing (" << SDL_GetError() << ")." << std::endl;
 		if (SDL_GL_SetSwapInterval(1) != 0) {
 			std::cerr << "NOTE: couldn't set vsync (" << SDL_GetError() << ")." << std::endl;
+			//...so limit the frame rate to the display's instead (unless told otherwise):
+			if (fps_limit < 0) {
+				SDL_DisplayMode mode;
+				if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+					fps_limit = mode.refresh_rate;
+				} else {
+					fps_limit = 60;
+				}
+				std::cerr << "NOTE: limiting frame rate to " << fps_limit << " frames per second." << std::endl;
+			}
 		}
 	}
 
@@ -96,10 +170,49 @@ int main(int argc, char **argv) {
 	Sound::init();
 
 	//------------ load assets --------------
-	call_load_functions();
+	//keep compiled shader programs between runs (when the driver allows it):
+	if (char *pref_path = SDL_GetPrefPath("15-466", "pentaton")) {
+		gl_set_program_cache_directory(pref_path);
+		SDL_free(pref_path);
+	}
+
+	//lazily-loaded resources that aren't in use get unloaded when they add up to more than this:
+	set_lazy_load_budget(256 << 20);
+
+	//load in the background, showing a progress bar in the meantime:
+	bool quit_while_loading = false;
+	begin_load_functions();
+	while (!update_load_functions(1.0f / 60.0f)) {
+		SDL_Event evt;
+		while (SDL_PollEvent(&evt) == 1) {
+			if (evt.type == SDL_QUIT) quit_while_loading = true;
+		}
+
+		//(drawn with scissored clears, since shader programs may not be loaded yet)
+		int w,h;
+		SDL_GL_GetDrawableSize(window, &w, &h);
+		glViewport(0, 0, w, h);
+		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glEnable(GL_SCISSOR_TEST);
+		int bar_width = w / 2;
+		int bar_height = std::max(2, h / 40);
+		glScissor((w - bar_width) / 2, (h - bar_height) / 2, bar_width, bar_height);
+		glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glScissor((w - bar_width) / 2, (h - bar_height) / 2, int(bar_width * load_progress()), bar_height);
+		glClearColor(0.9f, 0.9f, 0.9f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+
+		SDL_GL_SwapWindow(window);
+	}
 
 	//------------ create game mode + make current --------------
-	Mode::set_current(std::make_shared< PlayMode >());
+	if (!quit_while_loading) {
+		Mode::set_current(std::make_shared< PlayMode >());
+	}
 
 	//------------ main loop ------------
 
@@ -118,72 +231,286 @@ int main(int argc, char **argv) {
 	};
 	on_resize();
 
-	//This will loop until the current mode is set to null:
-	while (Mode::current) {
-		//every pass through the game loop creates one frame of output
-		//  by performing three steps:
+	//(1) process any events that are pending:
+	// (when the mode is being updated on another thread, pass 'mode_mutex' to hold it while the mode handles events)
+	auto handle_events = [&](std::mutex *mode_mutex) {
+		PROFILE_ZONE("events");
+		static SDL_Event evt;
+		while (SDL_PollEvent(&evt) == 1) {
+			//handle resizing:
+			if (evt.type == SDL_WINDOWEVENT && evt.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+				on_resize();
+			}
+			//toggle the frame timing overlay (before the mode sees the key, so it works in every mode):
+			if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F3) {
+				FrameStats::show_overlay = !FrameStats::show_overlay;
+				continue;
+			}
+			//start/stop recording frames:
+			if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F11) {
+				if (Screenshot::capturing()) Screenshot::stop_capture();
+				else Screenshot::start_capture(capture_settings);
+				continue;
+			}
+			//handle input:
+			std::unique_lock< std::mutex > lock;
+			if (mode_mutex) lock = std::unique_lock< std::mutex >(*mode_mutex);
+			if (Mode::current && Mode::current->handle_event(evt, window_size)) {
+				// mode handled it; great
+				continue;
+			} else if (evt.type == SDL_QUIT) {
+				Mode::set_current(nullptr);
+				break;
+			}
+			if (lock.owns_lock()) lock.unlock();
+
+			if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_PRINTSCREEN) {
+				// --- screenshot key ---
+				// (of the most recently shown frame; written in the background)
+				std::string filename = "screenshot.png";
+				std::cout << "Saving screenshot to '" << filename << "'." << std::endl;
+				Screenshot::save(filename, drawable_size, GL_FRONT);
+			} else if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F12) {
+				// --- trace key ---
+				std::string filename = "trace.json";
+				std::cout << "Saving trace to '" << filename << "' (open with chrome://tracing or ui.perfetto.dev)." << std::endl;
+				profiler_write_trace(filename);
+			}
+		}
+	};
+
+	//when limiting frame rate, frames start no sooner than this:
+	auto next_frame_time = std::chrono::steady_clock::now();
+
+	//(4) after the mode has drawn, finish up the frame and show it:
+	auto finish_frame = [&]() {
+		//record the frame, if recording (before the overlay, so recordings show just the game):
+		Screenshot::capture(drawable_size);
+
+		if (FrameStats::show_overlay) FrameStats::draw_overlay(drawable_size);
 
-		{ //(1) process any events that are pending
-			static SDL_Event evt;
-			while (SDL_PollEvent(&evt) == 1) {
-				//handle resizing:
-				if (evt.type == SDL_WINDOWEVENT && evt.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
-					on_resize();
+		//free lazily-loaded resources no longer in use (if over budget):
+		evict_lazy_loads();
+
+		//upload a little more of any textures that are streaming in:
+		TextureStream::update();
+
+		FrameStats::end_frame();
+
+		//pass any screenshots that have been read back to the encoding thread:
+		Screenshot::update();
+
+		if (fps_limit > 0) {
+			//wait out the rest of this frame's time slot:
+			// (sleeping until close to the deadline, then spinning, since sleeps can overshoot by a millisecond or more)
+			PROFILE_ZONE("frame limiter");
+			auto frame_time = std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(1.0 / fps_limit));
+			next_frame_time += frame_time;
+			auto now = std::chrono::steady_clock::now();
+			if (next_frame_time < now) {
+				next_frame_time = now; //(running behind; don't try to make up the time)
+			} else {
+				auto spin_margin = std::chrono::milliseconds(2);
+				if (next_frame_time - now > spin_margin) std::this_thread::sleep_until(next_frame_time - spin_margin);
+				while (std::chrono::steady_clock::now() < next_frame_time) std::this_thread::yield();
+			}
+		}
+
+		//Wait until the recently-drawn frame is shown before doing it all again:
+		PROFILE_ZONE("SDL_GL_SwapWindow");
+		SDL_GL_SwapWindow(window);
+	};
+
+	//run 'mode' with its updates on a simulation thread, drawing the snapshots it publishes on this thread,
+	// until the mode is changed, asks to quit (returns true if it asked to quit), or recording starts:
+	auto run_threaded_update = [&](std::shared_ptr< Mode > const &mode, std::shared_ptr< Mode::Snapshot const > const &first_snapshot) {
+		//held whenever the mode's state is being changed (i.e., while it updates or handles events):
+		std::mutex mode_mutex;
+
+		//passed between the threads:
+		struct {
+			std::mutex mutex; //guards everything below
+			std::shared_ptr< Mode::Snapshot const > snapshot; //latest snapshot published
+			std::chrono::steady_clock::time_point snapshot_time; //when the update that made it was due
+			glm::uvec2 drawable_size;
+			bool running = true; //cleared (by either thread) to stop the simulation thread
+			bool quit = false; //set if the mode's update asked to quit
+		} shared;
+		shared.snapshot = first_snapshot;
+		shared.snapshot_time = std::chrono::steady_clock::now();
+		shared.drawable_size = drawable_size;
+
+		auto const step = std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< float >(Mode::UpdateStep));
+
+		std::thread simulation([&]() {
+			profiler_set_thread_name("simulation");
+			auto update_time = shared.snapshot_time + step; //when the next update is due
+			while (true) {
+				std::this_thread::sleep_until(update_time);
+
+				glm::uvec2 size;
+				{
+					std::unique_lock< std::mutex > lock(shared.mutex);
+					if (!shared.running) break;
+					size = shared.drawable_size;
 				}
-				//handle input:
-				if (Mode::current && Mode::current->handle_event(evt, window_size)) {
-					// mode handled it; great
-				} else if (evt.type == SDL_QUIT) {
-					Mode::set_current(nullptr);
-					break;
-				} else if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_PRINTSCREEN) {
-					// --- screenshot key ---
-					std::string filename = "screenshot.png";
-					std::cout << "Saving screenshot to '" << filename << "'." << std::endl;
-					glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-					glReadBuffer(GL_FRONT);
-					int w,h;
-					SDL_GL_GetDrawableSize(window, &w, &h);
-					std::vector< glm::u8vec4 > data(w*h);
-					glReadPixels(0,0,w,h, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
-					for (auto &px : data) {
-						px.a = 0xff;
+
+				std::shared_ptr< Mode::Snapshot const > snapshot;
+				auto snapshot_time = update_time;
+				{
+					std::unique_lock< std::mutex > lock(mode_mutex);
+					if (Mode::current != mode) break; //(changed while handling an event)
+					bool quit = false;
+					{
+						PROFILE_ZONE("Mode::update");
+						mode->update(Mode::UpdateStep, &quit);
+					}
+					if (quit || Mode::current != mode) {
+						std::unique_lock< std::mutex > shared_lock(shared.mutex);
+						shared.quit = quit;
+						break;
+					}
+
+					update_time += step;
+					auto now = std::chrono::steady_clock::now();
+					//if updates are taking a very long time to process,
+					//lag to avoid spiral of death:
+					if (now - update_time > std::chrono::milliseconds(100)) update_time = now;
+					//(no point making a snapshot that the next update's snapshot will replace before it can be drawn)
+					if (update_time > now) {
+						PROFILE_ZONE("Mode::snapshot");
+						snapshot = mode->snapshot(size);
 					}
-					save_png(filename, glm::uvec2(w,h), data.data(), LowerLeftOrigin);
+				}
+				if (snapshot) {
+					std::unique_lock< std::mutex > lock(shared.mutex);
+					shared.snapshot.swap(snapshot); //(the old snapshot is freed outside the lock, if no longer being drawn)
+					shared.snapshot_time = snapshot_time;
 				}
 			}
-			if (!Mode::current) break;
+			std::unique_lock< std::mutex > lock(shared.mutex);
+			shared.running = false;
+		});
+
+		while (true) {
+			PROFILE_ZONE("frame");
+			FrameStats::begin_frame();
+
+			//(1) process any events that are pending (with the mode locked, so they don't arrive mid-update):
+			handle_events(&mode_mutex);
+			{
+				std::unique_lock< std::mutex > lock(mode_mutex);
+				if (Mode::current != mode) break;
+			}
+			//recordings need fixed game time per frame, which only the main thread's updates provide:
+			if (Screenshot::capturing()) break;
+
+			//(2) pick up the latest state from the simulation thread:
+			std::shared_ptr< Mode::Snapshot const > snapshot;
+			float alpha;
+			{
+				std::unique_lock< std::mutex > lock(shared.mutex);
+				if (!shared.running) break;
+				shared.drawable_size = drawable_size;
+				snapshot = shared.snapshot;
+				alpha = std::chrono::duration< float >(std::chrono::steady_clock::now() - shared.snapshot_time).count() / Mode::UpdateStep;
+			}
+
+			{ //(3) draw it (while the simulation thread works on the next update):
+				PROFILE_ZONE("Mode::draw_snapshot");
+				mode->draw_snapshot(*snapshot, drawable_size, std::min(1.0f, std::max(0.0f, alpha)));
+			}
+
+			finish_frame();
 		}
 
-		{ //(2) call the current mode's "update" function to deal with elapsed time:
-			auto current_time = std::chrono::high_resolution_clock::now();
-			static auto previous_time = current_time;
+		{
+			std::unique_lock< std::mutex > lock(shared.mutex);
+			shared.running = false;
+		}
+		simulation.join();
+		return shared.quit;
+	};
+
+	//Mode::update is called in fixed steps of Mode::UpdateStep seconds; time not yet simulated accumulates here:
+	float update_lag = 0.0f;
+	auto previous_time = std::chrono::steady_clock::now();
+
+	if (capture) Screenshot::start_capture(capture_settings);
+
+	//This will loop until the current mode is set to null:
+	while (Mode::current) {
+		if (threaded_update && !Screenshot::capturing()) {
+			//run the mode's updates on a simulation thread (if it supports that) until the mode changes, quits, or recording starts:
+			std::shared_ptr< Mode > mode = Mode::current;
+			std::shared_ptr< Mode::Snapshot const > first_snapshot = mode->snapshot(drawable_size);
+			if (first_snapshot) {
+				bool quit = run_threaded_update(mode, first_snapshot);
+				if (quit) break;
+				//(the main thread's updates pick up from here, if the next mode doesn't support threaded update)
+				update_lag = 0.0f;
+				previous_time = std::chrono::steady_clock::now();
+				continue;
+			}
+		}
+
+		//every pass through the game loop creates one frame of output
+		//  by performing three steps:
+		PROFILE_ZONE("frame");
+		FrameStats::begin_frame();
+
+		//(1) process any events that are pending
+		handle_events(nullptr);
+		if (!Mode::current) break;
+
+		{ //(2) call the current mode's "update" function as many times as needed to catch up with elapsed time:
+			auto current_time = std::chrono::steady_clock::now();
 			float elapsed = std::chrono::duration< float >(current_time - previous_time).count();
 			previous_time = current_time;
 
+			//while recording, every frame shows the same amount of game time (however long it really took),
+			// so recordings play back evenly and the same input makes the same frames:
+			if (Screenshot::capturing()) elapsed = 1.0f / capture_fps;
+
+			update_lag += elapsed;
+
 			//if frames are taking a very long time to process,
 			//lag to avoid spiral of death:
-			elapsed = std::min(0.1f, elapsed);
+			update_lag = std::min(0.1f, update_lag);
 
 			bool quit = false;
-			Mode::current->update(elapsed, &quit);
+			while (update_lag >= Mode::UpdateStep) {
+				PROFILE_ZONE("Mode::update");
+				Mode::current->update(Mode::UpdateStep, &quit);
+				update_lag -= Mode::UpdateStep;
+				if (quit || !Mode::current) break;
+			}
 			if (quit) break;
 			if (!Mode::current) break;
 		}
 
 		{ //(3) call the current mode's "draw" function to produce output:
-		
-			Mode::current->draw(drawable_size);
+			PROFILE_ZONE("Mode::draw");
+			Mode::current->draw(drawable_size, update_lag / Mode::UpdateStep);
 		}
 
-		//Wait until the recently-drawn frame is shown before doing it all again:
-		SDL_GL_SwapWindow(window);
+		finish_frame();
 	}
 
 
 	//------------  teardown ------------
 	Sound::shutdown();
 
+	if (!trace_filename.empty()) {
+		std::cout << "Saving trace to '" << trace_filename << "'." << std::endl;
+		profiler_write_trace(trace_filename);
+	}
+
+	//(screenshots need the OpenGL context to finish reading back)
+	Screenshot::finish();
+	TextureStream::finish();
+	finish_load_functions(); //(waits for any prefetches)
+
 	SDL_GL_DeleteContext(context);
 	context = 0;
 
@@ -0,0 +1,67 @@
+//Packs PNG images into a '.tarr' file (the format read by TextureArray),
+// so texture arrays can be loaded without decoding or resizing anything.
+
+#include "TextureArray.hpp"
+#include "read_write_chunk.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//------------ file contents (must match TextureArray::TextureArray) --------------
+
+struct Header {
+	uint32_t width, height, layers;
+};
+static_assert(sizeof(Header) == 12, "Header is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+};
+static_assert(sizeof(IndexEntry) == 8, "Index entry is packed.");
+
+int main(int argc, char **argv) {
+	//------------ command line --------------
+	if (argc < 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <path/to/output.tarr> <image.png> [image.png ...]\n"
+			"Writes every image as one layer of a texture array (stretching them all to the largest width and height among them).\n"
+			"Images are looked up by filename, without directory or '.png'." << std::endl;
+		return 1;
+	}
+	std::string output = argv[1];
+	std::vector< std::string > filenames(argv + 2, argv + argc);
+
+	//------------ pack --------------
+	glm::uvec2 size;
+	std::vector< glm::u8vec4 > pixels;
+	std::vector< std::string > names;
+	TextureArray::pack(filenames, &size, &pixels, &names);
+
+	std::vector< Header > header(1, Header{ size.x, size.y, uint32_t(names.size()) });
+	std::vector< char > strings;
+	std::vector< IndexEntry > index;
+	for (auto const &name : names) {
+		IndexEntry entry;
+		entry.name_begin = uint32_t(strings.size());
+		strings.insert(strings.end(), name.begin(), name.end());
+		entry.name_end = uint32_t(strings.size());
+		index.emplace_back(entry);
+	}
+
+	//------------ write --------------
+	std::ofstream out(output, std::ios::binary);
+	write_chunk("tas0", header, &out);
+	write_chunk("rgba", pixels, &out);
+	write_chunk("str0", strings, &out);
+	write_chunk("idx0", index, &out);
+	if (!out) {
+		throw std::runtime_error("Failed to write '" + output + "'.");
+	}
+
+	std::cout << "Wrote " << names.size() << " " << size.x << "x" << size.y << " layers to '" << output << "'." << std::endl;
+
+	return 0;
+}
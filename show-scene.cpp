@@ -2,9 +2,12 @@
 #include "ShowSceneMode.hpp"
 #include "Load.hpp"
 #include "GL.hpp"
-#include "load_save_png.hpp"
+#include "Screenshot.hpp"
 #include "ShowSceneProgram.hpp"
 
+//for the frame timing overlay:
+#include "FrameStats.hpp"
+
 #include <SDL.h>
 
 #include <chrono>
@@ -120,6 +123,9 @@ int main(int argc, char **argv) {
 				drawable.pipeline.type = mesh.type;
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
+				drawable.pipeline.index_type = mesh.index_type;
+				drawable.pipeline.min = mesh.min;
+				drawable.pipeline.max = mesh.max;
 
 			});
 		} catch (std::exception &e) {
@@ -164,6 +170,7 @@ int main(int argc, char **argv) {
 	while (Mode::current) {
 		//every pass through the game loop creates one frame of output
 		//  by performing three steps:
+		FrameStats::begin_frame();
 
 		{ //(1) process any events that are pending
 			static SDL_Event evt;
@@ -172,6 +179,11 @@ int main(int argc, char **argv) {
 				if (evt.type == SDL_WINDOWEVENT && evt.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
 					on_resize();
 				}
+				//toggle the frame timing overlay (before the mode sees the key, so it works in every mode):
+				if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F3) {
+					FrameStats::show_overlay = !FrameStats::show_overlay;
+					continue;
+				}
 				//handle input:
 				if (Mode::current && Mode::current->handle_event(evt, window_size)) {
 					// mode handled it; great
@@ -180,18 +192,10 @@ int main(int argc, char **argv) {
 					break;
 				} else if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_PRINTSCREEN) {
 					// --- screenshot key ---
+					// (of the most recently shown frame; written in the background)
 					std::string filename = "screenshot.png";
 					std::cout << "Saving screenshot to '" << filename << "'." << std::endl;
-					glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-					glReadBuffer(GL_FRONT);
-					int w,h;
-					SDL_GL_GetDrawableSize(window, &w, &h);
-					std::vector< glm::u8vec4 > data(w*h);
-					glReadPixels(0,0,w,h, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
-					for (auto &px : data) {
-						px.a = 0xff;
-					}
-					save_png(filename, glm::uvec2(w,h), data.data(), LowerLeftOrigin);
+					Screenshot::save(filename, drawable_size, GL_FRONT);
 				}
 			}
 			if (!Mode::current) break;
@@ -215,15 +219,24 @@ int main(int argc, char **argv) {
 
 		{ //(3) call the current mode's "draw" function to produce output:
 		
-			Mode::current->draw(drawable_size);
+			Mode::current->draw(drawable_size, 1.0f); //(updated with the whole elapsed time, so nothing to interpolate)
+			if (FrameStats::show_overlay) FrameStats::draw_overlay(drawable_size);
 		}
 
+		FrameStats::end_frame();
+
+		//pass any screenshots that have been read back to the encoding thread:
+		Screenshot::update();
+
 		//Wait until the recently-drawn frame is shown before doing it all again:
 		SDL_GL_SwapWindow(window);
 	}
 
 
 	//------------  teardown ------------
+	//(screenshots need the OpenGL context to finish reading back)
+	Screenshot::finish();
+
 	SDL_GL_DeleteContext(context);
 	context = 0;
 